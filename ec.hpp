@@ -10,21 +10,157 @@
 #include <typeinfo>
 #include <array>
 #include <utility>
+#include <coroutine>
+#include <atomic>
+#include <exception>
+#include <span>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <new>
+#include <fstream>
+#include <chrono>
+#include <initializer_list>
+#include <tuple>
+#include <cstdio>
+#include <cstdlib>
+#include <bit>
+#include <cassert>
+#include <optional>
+
+#if defined(EC_NUMA)
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EC_MMAP 1
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Arrow C data interface, as specified by Apache Arrow
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char *format;
+    const char *name;
+    const char *metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema **children;
+    struct ArrowSchema *dictionary;
+    void (*release)(struct ArrowSchema*);
+    void *private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void **buffers;
+    struct ArrowArray **children;
+    struct ArrowArray *dictionary;
+    void (*release)(struct ArrowArray*);
+    void *private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
 
 namespace ec {
 
 using Entity = std::uint32_t;
 enum class Status { OK = 0, ERROR = 1 };
 
+inline constexpr Entity NullEntity = std::numeric_limits<Entity>::max();
+inline constexpr std::size_t NullType = std::numeric_limits<std::size_t>::max();
+
 struct PoolBase {
+    // Presence flag per entity
+    std::vector<char> mask;
+
+    // typeid hash of the stored component, used to match pools across worlds
+    std::size_t typeHash = 0;
+    std::size_t elemSize  = 0;
+    std::size_t elemAlign = 1;
+    std::string name;
+
     virtual ~PoolBase() = default;
     virtual auto ensureSize(std::size_t n) -> void = 0;
+
+    // Preallocate storage for n entity slots without changing the size
+    virtual auto reserve(std::size_t n) -> void { mask.reserve(n); }
+
+    // Bytes one entity slot costs in this pool, for memory budgets
+    virtual auto slotBytes() const -> std::size_t { return elemSize + 1; }
+
+    // Start of the contiguous component array (elemSize bytes per entity)
+    virtual auto rawData() -> void* = 0;
+
+    // Address of entity e's component
+    virtual auto rawAt(std::size_t e) -> void* {
+        return static_cast<std::byte*>(rawData()) + e * elemSize;
+    }
+
+    // Empty pool of the same component type
+    virtual auto create() const -> std::unique_ptr<PoolBase> = 0;
+
+    // Copy one component in from untyped memory of the stored type
+    virtual auto assignRaw(std::size_t e, const void *src) -> void = 0;
+
+    // Whether src (of the stored type) is a value this pool can hold
+    virtual auto accepts(const void *src) const -> bool { (void)src; return true; }
+
+    // Copy data and mask of count entities from a pool of the same type
+    virtual auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t count) -> void = 0;
+
+    // Drop entity e's component
+    virtual auto erase(std::size_t e) -> void { mask[e] = 0; }
+
+    // Rebuild derived indexes after mask and data were written in bulk
+    virtual auto refresh() -> void {}
+
+    // Release resident pages of file-backed storage; no-op for heap pools
+    virtual auto evict() -> void {}
+
+    // Whether rawData() is available without changing the storage layout
+    virtual auto contiguous() const -> bool { return true; }
+
+    // Switch layout if the pool wants to; only called at safe points, since
+    // it may move the storage. Returns true if it did.
+    virtual auto adapt() -> bool { return false; }
+
+    // Drop all components of entities below n; storage is kept
+    virtual auto clear(std::size_t n) -> void {
+        std::memset(mask.data(), 0, std::min(n, mask.size()));
+    }
 };
 
 template<typename T>
 struct Pool : PoolBase {
-    std::vector<T>    data;
-    std::vector<char> mask;
+    std::vector<T> data;
+
+    Pool() {
+        typeHash = typeid(T).hash_code();
+        elemSize  = sizeof(T);
+        elemAlign = alignof(T);
+        name      = typeid(T).name();
+    }
 
     auto ensureSize(std::size_t n) -> void override {
         if (data.size() < n) {
@@ -32,180 +168,3719 @@ struct Pool : PoolBase {
             mask.resize(n, 0);
         }
     }
+
+    auto reserve(std::size_t n) -> void override {
+        data.reserve(n);
+        mask.reserve(n);
+    }
+
+    auto rawData() -> void* override {
+        return data.data();
+    }
+
+    // Store a component for e and mark it present
+    auto assign(std::size_t e, const T &v) -> void {
+        data[e] = v;
+        mask[e] = 1;
+    }
+
+    // Component of e or nullptr
+    auto get(std::size_t e) -> T* {
+        return e < mask.size() && mask[e] ? &data[e] : nullptr;
+    }
+
+    // Start of the per-entity component array
+    auto values() -> T* {
+        return data.data();
+    }
+
+    auto create() const -> std::unique_ptr<PoolBase> override {
+        return std::make_unique<Pool<T>>();
+    }
+
+    auto assignRaw(std::size_t e, const void *src) -> void override {
+        data[e] = *static_cast<const T*>(src);
+    }
+
+    auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t count) -> void override {
+        // Lowers to memmove for trivially copyable components
+        std::copy_n(static_cast<const Pool<T>&>(src).data.begin() + srcBegin, count, data.begin() + dstBegin);
+        std::memcpy(mask.data() + dstBegin, src.mask.data() + srcBegin, count);
+    }
 };
 
-struct World {
-    // Alive flags per entity
-    std::vector<char> alive;
-    Entity nextEntity = 0;
+// Buckets entities by the value of a small discriminator component (an enum
+// or integer in [0, N)) so each value can be iterated without branching on
+// it. State transitions through add_component are O(1) swap-removes; writes
+// through component pointers bypass the buckets and must not change the value.
+// add_component rejects values outside [0, N); bulk loads drop them.
+template<typename T, std::size_t N>
+struct PartitionedPool final : Pool<T> {
+    static_assert(std::is_enum_v<T> || std::is_integral_v<T>, "Partition key must be an enum or integer");
 
-    // Type-erased component pools
-    std::vector<std::unique_ptr<PoolBase>> pools;
+    std::array<std::vector<Entity>, N> buckets;
+    std::vector<std::uint32_t> slot;
 
-    // Map: type hash -> compact ID
-    std::unordered_map<std::size_t, std::size_t> typeMap;
-    std::size_t typeCounter = 0;
+    static auto bucketOf(const T &v) -> std::size_t { return static_cast<std::size_t>(v); }
 
-    World(std::size_t entityCap = 16, std::size_t compCap = 8) {
-        alive.reserve(entityCap);
-        pools.reserve(compCap);
-        typeMap.reserve(compCap);
+    auto accepts(const void *src) const -> bool override {
+        return bucketOf(*static_cast<const T*>(src)) < N;
     }
 
-    // Get or assign an ID for component type T
-    template<typename T>
-    auto getTypeId() -> std::size_t {
-        static_assert(std::is_standard_layout_v<T>, "Component must be standard-layout");
+    auto link(std::size_t e) -> void {
+        assert(bucketOf(this->data[e]) < N && "Partition key out of range");
+        auto &bucket = buckets[bucketOf(this->data[e])];
+        slot[e] = static_cast<std::uint32_t>(bucket.size());
+        bucket.push_back(static_cast<Entity>(e));
+    }
 
-        const auto hash = typeid(T).hash_code();
-        auto it = typeMap.find(hash);
-        if (it != typeMap.end()) {
-            return it->second;
+    auto unlink(std::size_t e) -> void {
+        auto &bucket = buckets[bucketOf(this->data[e])];
+        const auto last = bucket.back();
+        bucket[slot[e]] = last;
+        slot[last] = slot[e];
+        bucket.pop_back();
+    }
+
+    auto ensureSize(std::size_t n) -> void override {
+        Pool<T>::ensureSize(n);
+        if (slot.size() < n) {
+            slot.resize(n, 0);
         }
+    }
 
-        const auto id = typeCounter++;
-        typeMap.emplace(hash, id);
+    // Every bucket can hold all n entities, so no state mix reallocates
+    auto reserve(std::size_t n) -> void override {
+        Pool<T>::reserve(n);
+        slot.reserve(n);
+        for (auto &bucket : buckets) {
+            bucket.reserve(n);
+        }
+    }
 
-        if (id >= pools.size()) {
-            pools.resize(id + 1);
+    // Slot index plus one reserved entry in each bucket
+    auto slotBytes() const -> std::size_t override {
+        return Pool<T>::slotBytes() + sizeof(std::uint32_t) + N * sizeof(Entity);
+    }
+
+    auto assign(std::size_t e, const T &v) -> void {
+        assert(bucketOf(v) < N && "Partition key out of range");
+        if (this->mask[e]) {
+            if (bucketOf(this->data[e]) == bucketOf(v)) {
+                this->data[e] = v;
+                return;
+            }
+            unlink(e);
         }
+        Pool<T>::assign(e, v);
+        link(e);
+    }
 
-        return id;
+    auto erase(std::size_t e) -> void override {
+        if (this->mask[e]) {
+            unlink(e);
+        }
+        this->mask[e] = 0;
     }
 
-    // Ensure storage for entity e
-    auto ensureEntity(std::size_t e) -> void {
-        if (e >= alive.size()) {
-            alive.resize(e + 1, 0);
-            for (auto &bp : pools) {
-                if (bp) {
-                    bp->ensureSize(e + 1);
-                }
+    auto assignRaw(std::size_t e, const void *src) -> void override {
+        assign(e, *static_cast<const T*>(src));
+    }
+
+    auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t count) -> void override {
+        for (std::size_t e = dstBegin; e < dstBegin + count; ++e) {
+            if (this->mask[e]) {
+                unlink(e);
+            }
+        }
+        Pool<T>::copyRange(src, srcBegin, dstBegin, count);
+        for (std::size_t e = dstBegin; e < dstBegin + count; ++e) {
+            if (this->mask[e]) {
+                link(e);
             }
         }
     }
 
-    // Ensure pool for typeId exists and sized
-    template<typename T>
-    auto ensurePool(std::size_t typeId) -> Pool<T>& {
-        if (!pools[typeId]) {
-            pools[typeId] = std::make_unique<Pool<T>>();
+    auto clear(std::size_t n) -> void override {
+        PoolBase::clear(n);
+        for (auto &bucket : buckets) {
+            bucket.clear();
         }
+    }
 
-        auto &pl = *static_cast<Pool<T>*>(pools[typeId].get());
-        pl.ensureSize(alive.size());
+    // Loaded keys outside [0, N) cannot be bucketed and are dropped
+    auto refresh() -> void override {
+        for (auto &bucket : buckets) {
+            bucket.clear();
+        }
+        for (std::size_t e = 0; e < this->mask.size(); ++e) {
+            if (this->mask[e] && bucketOf(this->data[e]) >= N) {
+                this->mask[e] = 0;
+            }
+            if (this->mask[e]) {
+                link(e);
+            }
+        }
+    }
 
-        return pl;
+    auto create() const -> std::unique_ptr<PoolBase> override {
+        return std::make_unique<PartitionedPool>();
     }
 };
 
-inline auto create_entity(World &w) -> Entity {
-    const auto id = w.nextEntity++;
-    w.ensureEntity(id);
-    w.alive[id] = 1;
-    return id;
-}
+// Switches between the dense Pool<T> layout and a sparse set as occupancy
+// (components per entity slot) changes. Sparse mode packs values and owners
+// into parallel arrays with a per-entity slot index and frees the full-length
+// array; queries then walk the packed owners instead of every entity. It goes
+// sparse below SparsePercent and dense again above DensePercent; the gap keeps
+// churn around one threshold from migrating back and forth. The mask is kept in
+// both modes. add/remove check the thresholds and migrate right away, unless
+// a query is running on the world; then the switch happens when the
+// outermost query returns (World::queryDepth), so storage never moves under
+// a running loop. rawData() densifies for bulk users that need one array;
+// bulk paths that can work per entity check contiguous() first, and
+// adapt(world) restores the layout occupancy calls for.
+template<typename T, std::size_t SparsePercent = 5, std::size_t DensePercent = 20>
+struct AdaptivePool final : Pool<T> {
+    static_assert(SparsePercent < DensePercent, "Thresholds need a hysteresis gap");
 
-inline auto destroy_entity(World &w, Entity e) -> void {
-    if (e < w.alive.size()) {
-        w.alive[e] = 0;
+    // Smaller pools always stay dense
+    static constexpr std::size_t MinSparse = 1024;
+
+    bool sparse = false;
+    std::size_t count = 0;
+    std::vector<T> packed;
+    std::vector<Entity> entities;
+    std::vector<std::uint32_t> index;
+
+    auto toSparse() -> void {
+        for (std::size_t e = 0; e < this->mask.size(); ++e) {
+            if (this->mask[e]) {
+                packed.push_back(this->data[e]);
+                entities.push_back(static_cast<Entity>(e));
+            }
+        }
+        index.resize(this->mask.size());
+        for (std::size_t i = 0; i < entities.size(); ++i) {
+            index[entities[i]] = static_cast<std::uint32_t>(i);
+        }
+        std::vector<T>().swap(this->data);
+        sparse = true;
     }
-}
 
-// Add a component: validates, finds pool, stores data
-template<typename T>
-inline auto add_component(World &w, Entity e, const T &comp) -> Status {
-    // 1. Validate entity
-    if (e >= w.alive.size() || !w.alive[e]) {
-        return Status::ERROR;
+    auto toDense() -> void {
+        this->data.resize(this->mask.size());
+        for (std::size_t i = 0; i < entities.size(); ++i) {
+            this->data[entities[i]] = packed[i];
+        }
+        std::vector<T>().swap(packed);
+        std::vector<Entity>().swap(entities);
+        std::vector<std::uint32_t>().swap(index);
+        sparse = false;
     }
 
-    // 2. Get component-type ID
-    const auto tid  = w.getTypeId<T>();
+    // Migrate if occupancy crossed the threshold away from the current layout
+    auto adapt() -> bool override {
+        const auto slots = this->mask.size();
+        if (sparse && count * 100 > slots * DensePercent) {
+            toDense();
+            return true;
+        }
+        if (!sparse && slots >= MinSparse && count * 100 < slots * SparsePercent) {
+            toSparse();
+            return true;
+        }
+        return false;
+    }
 
-    // 3. Ensure pool exists and is sized
-    auto &pool = w.ensurePool<T>(tid);
+    auto contiguous() const -> bool override { return !sparse; }
 
-    // 4. Assign data and mark
-    pool.data[e] = comp;
-    pool.mask[e] = 1;
+    auto ensureSize(std::size_t n) -> void override {
+        if (this->mask.size() >= n) {
+            return;
+        }
+        if (sparse) {
+            this->mask.resize(n, 0);
+            index.resize(n);
+        } else {
+            Pool<T>::ensureSize(n);
+        }
+    }
 
-    return Status::OK;
-}
+    auto reserve(std::size_t n) -> void override {
+        if (sparse) {
+            this->mask.reserve(n);
+            index.reserve(n);
+        } else {
+            Pool<T>::reserve(n);
+        }
+    }
 
-// Get a component pointer or nullptr
-template<typename T>
-inline auto get_component(World &w, Entity e) -> T* {
-    const auto tid = w.getTypeId<T>();
-    if (tid >= w.pools.size() || !w.pools[tid]) {
-        return nullptr;
+    auto rawData() -> void* override {
+        if (sparse) {
+            toDense();
+        }
+        return this->data.data();
     }
 
-    auto &pool = *static_cast<Pool<T>*>(w.pools[tid].get());
-    if (e >= pool.data.size() || !pool.mask[e]) {
-        return nullptr;
+    auto rawAt(std::size_t e) -> void* override {
+        return sparse ? static_cast<void*>(&packed[index[e]]) : static_cast<void*>(&this->data[e]);
     }
 
-    return &pool.data[e];
-}
+    auto get(std::size_t e) -> T* {
+        if (e >= this->mask.size() || !this->mask[e]) {
+            return nullptr;
+        }
+        return sparse ? &packed[index[e]] : &this->data[e];
+    }
+
+    auto assign(std::size_t e, const T &v) -> void {
+        if (this->mask[e]) {
+            *get(e) = v;
+            return;
+        }
+        if (sparse) {
+            index[e] = static_cast<std::uint32_t>(packed.size());
+            packed.push_back(v);
+            entities.push_back(static_cast<Entity>(e));
+        } else {
+            this->data[e] = v;
+        }
+        this->mask[e] = 1;
+        ++count;
+    }
+
+    auto erase(std::size_t e) -> void override {
+        if (!this->mask[e]) {
+            return;
+        }
+        if (sparse) {
+            const auto i = index[e];
+            packed[i] = packed.back();
+            entities[i] = entities.back();
+            index[entities[i]] = i;
+            packed.pop_back();
+            entities.pop_back();
+        }
+        this->mask[e] = 0;
+        --count;
+    }
+
+    auto assignRaw(std::size_t e, const void *src) -> void override {
+        assign(e, *static_cast<const T*>(src));
+    }
+
+    auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t n) -> void override {
+        auto &from = static_cast<const AdaptivePool&>(src);
+        if (!sparse && !from.sparse) {
+            count -= static_cast<std::size_t>(std::count(this->mask.begin() + dstBegin, this->mask.begin() + dstBegin + n, 1));
+            Pool<T>::copyRange(src, srcBegin, dstBegin, n);
+            count += static_cast<std::size_t>(std::count(this->mask.begin() + dstBegin, this->mask.begin() + dstBegin + n, 1));
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto e = srcBegin + i;
+            if (from.mask[e]) {
+                assign(dstBegin + i, from.sparse ? from.packed[from.index[e]] : from.data[e]);
+            } else {
+                erase(dstBegin + i);
+            }
+        }
+    }
+
+    auto clear(std::size_t n) -> void override {
+        PoolBase::clear(n);
+        packed.clear();
+        entities.clear();
+        count = 0;
+    }
+
+    // Mask and data were written through rawData(), so the pool is dense
+    auto refresh() -> void override {
+        count = static_cast<std::size_t>(std::count(this->mask.begin(), this->mask.end(), 1));
+    }
+
+    auto create() const -> std::unique_ptr<PoolBase> override {
+        return std::make_unique<AdaptivePool>();
+    }
+};
+
+#if EC_MMAP
+// Pool whose component array lives in a shared mapping of an unlinked
+// temporary file, so the OS can write cold pages back and drop them under
+// memory pressure instead of holding them in RAM. Masks stay on the heap.
+// Access is hinted as random; evict() flushes and drops resident pages and
+// later accesses fault them back in. Files go to mappedPoolDir, $TMPDIR or
+// /tmp. Components must be trivially copyable.
+inline const char *mappedPoolDir = nullptr;
 
-// Remove a component
 template<typename T>
-inline auto remove_component(World &w, Entity e) -> Status {
-    const auto tid = w.getTypeId<T>();
-    if (tid >= w.pools.size() || !w.pools[tid]) {
-        return Status::ERROR;
+struct MappedPool final : Pool<T> {
+    static_assert(std::is_trivially_copyable_v<T>, "Mapped components must be trivially copyable");
+
+    int fd = -1;
+    T *mapped = nullptr;
+    std::size_t capacity = 0;
+
+    MappedPool() = default;
+    MappedPool(const MappedPool&) = delete;
+    auto operator=(const MappedPool&) -> MappedPool& = delete;
+
+    ~MappedPool() override {
+        if (mapped) {
+            munmap(mapped, capacity * sizeof(T));
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
     }
 
-    auto &pool = *static_cast<Pool<T>*>(w.pools[tid].get());
-    if (e < pool.mask.size()) {
-        pool.mask[e] = 0;
+    // Grow the file and remap it; existing contents stay in the file
+    auto remap(std::size_t n) -> void {
+        if (fd < 0) {
+            const char *dir = mappedPoolDir ? mappedPoolDir : std::getenv("TMPDIR");
+            std::string path = std::string(dir ? dir : "/tmp") + "/ec-pool-XXXXXX";
+            fd = mkstemp(path.data());
+            if (fd < 0) {
+                throw std::bad_alloc();
+            }
+            unlink(path.c_str());
+        }
+
+        if (ftruncate(fd, static_cast<off_t>(n * sizeof(T))) != 0) {
+            throw std::bad_alloc();
+        }
+        if (mapped) {
+            munmap(mapped, capacity * sizeof(T));
+        }
+        auto *p = mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            mapped = nullptr;
+            capacity = 0;
+            throw std::bad_alloc();
+        }
+        madvise(p, n * sizeof(T), MADV_RANDOM);
+        mapped = static_cast<T*>(p);
+        capacity = n;
     }
 
-    return Status::OK;
-}
+    auto ensureSize(std::size_t n) -> void override {
+        if (n > capacity) {
+            remap(std::max(n, capacity * 2));
+        }
+        if (this->mask.size() < n) {
+            this->mask.resize(n, 0);
+        }
+    }
 
-template<typename... Ts, typename Func, std::size_t... I>
-inline auto invoke_query(Entity e, Func f, void* ptrs[],  std::index_sequence<I...>) -> void {
-    f(e, static_cast<Ts*>(ptrs[I])...);
-}
+    auto reserve(std::size_t n) -> void override {
+        if (n > capacity) {
+            remap(n);
+        }
+        this->mask.reserve(n);
+    }
 
-template<typename... Ts, typename Func>
-inline auto query(World &w, Func f) -> void {
-    // Collect type IDs for Ts
-    std::array<std::size_t, sizeof...(Ts)> types = { w.getTypeId<Ts>()... };
+    // Only the mask is resident; component data is file-backed
+    auto slotBytes() const -> std::size_t override { return 1; }
 
-    // Iterate all entities
-    for (Entity e = 0; e < w.nextEntity; ++e) {
-        if (e >= w.alive.size() || !w.alive[e]) {
-            continue;
+    auto rawData() -> void* override { return mapped; }
+    auto values() -> T* { return mapped; }
+
+    auto get(std::size_t e) -> T* {
+        return e < this->mask.size() && this->mask[e] ? mapped + e : nullptr;
+    }
+
+    auto assign(std::size_t e, const T &v) -> void {
+        mapped[e] = v;
+        this->mask[e] = 1;
+    }
+
+    auto assignRaw(std::size_t e, const void *src) -> void override {
+        std::memcpy(mapped + e, src, sizeof(T));
+    }
+
+    auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t count) -> void override {
+        std::memcpy(mapped + dstBegin, static_cast<const MappedPool&>(src).mapped + srcBegin, count * sizeof(T));
+        std::memcpy(this->mask.data() + dstBegin, src.mask.data() + srcBegin, count);
+    }
+
+    auto evict() -> void override {
+        if (!mapped) {
+            return;
         }
+        const auto bytes = capacity * sizeof(T);
+        msync(mapped, bytes, MS_SYNC);
+        madvise(mapped, bytes, MADV_DONTNEED);
+#if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, 0, static_cast<off_t>(bytes), POSIX_FADV_DONTNEED);
+#endif
+    }
 
-        bool match = true;
-        void* ptrs[sizeof...(Ts)];
-        std::size_t idx = 0;
-
-        // Check each component mask and record data ptr
-        (([&]() {
-            auto &pl = *static_cast<Pool<Ts>*>(w.pools[types[idx]].get());
-            if (e >= pl.mask.size() || !pl.mask[e]) {
-                match = false;
-            } else {
-                ptrs[idx] = &pl.data[e];
+    auto create() const -> std::unique_ptr<PoolBase> override {
+        return std::make_unique<MappedPool>();
+    }
+};
+#else
+// No mappings without POSIX; mapped components stay on the heap
+template<typename T>
+using MappedPool = Pool<T>;
+#endif
+
+// Storage used for component type T. Specialize to pick another layout, e.g.
+//   template<> struct ec::component_storage<State> { using type = ec::PartitionedPool<State, 4>; };
+// The storage must derive from Pool<T>.
+template<typename T>
+struct component_storage {
+    using type = Pool<T>;
+};
+
+template<typename T>
+using storage_t = typename component_storage<std::remove_const_t<T>>::type;
+
+template<typename S>
+struct is_adaptive_storage : std::false_type {};
+
+template<typename T, std::size_t S, std::size_t D>
+struct is_adaptive_storage<AdaptivePool<T, S, D>> : std::true_type {};
+
+template<typename T>
+inline constexpr bool is_adaptive_v = is_adaptive_storage<storage_t<T>>::value;
+
+// Logical component stored as two physical ones: Hot and Cold live in their
+// own pools, so queries over Hot stream only the frequently used fields.
+// add/get/remove_component on a Split act on both parts; get_component returns
+// a SplitPtr pointing into each pool. Query the parts directly.
+template<typename Hot, typename Cold>
+struct Split {
+    Hot hot;
+    Cold cold;
+};
+
+template<typename Hot, typename Cold>
+struct SplitPtr {
+    Hot *hot = nullptr;
+    Cold *cold = nullptr;
+
+    explicit operator bool() const { return hot != nullptr; }
+};
+
+template<typename T>
+struct is_split : std::false_type {};
+
+template<typename Hot, typename Cold>
+struct is_split<Split<Hot, Cold>> : std::true_type {};
+
+template<typename T>
+inline constexpr bool is_split_v = is_split<std::remove_const_t<T>>::value;
+
+// Layout and lifecycle of a component type defined at runtime.
+// Null callbacks mean zero-fill construction, no destruction and memcpy copies.
+struct ComponentInfo {
+    std::size_t size  = 0;
+    std::size_t align = alignof(std::max_align_t);
+    void (*construct)(void *dst) = nullptr;
+    void (*destroy)(void *dst) = nullptr;
+    void (*copy)(void *dst, const void *src) = nullptr;
+};
+
+// Pool for runtime-defined components: the same one-slot-per-entity layout
+// as Pool<T>, over an aligned byte buffer with a stride of size rounded up
+// to align.
+struct RuntimePool : PoolBase {
+    ComponentInfo info;
+    std::byte *buffer = nullptr;
+    std::size_t count    = 0;
+    std::size_t capacity = 0;
+
+    RuntimePool(std::string_view typeName, std::size_t hash, const ComponentInfo &ci) : info(ci) {
+        info.align = std::max<std::size_t>(info.align, 1);
+        typeHash = hash;
+        elemSize  = (std::max<std::size_t>(info.size, 1) + info.align - 1) / info.align * info.align;
+        elemAlign = info.align;
+        name      = typeName;
+    }
+
+    RuntimePool(const RuntimePool&) = delete;
+    auto operator=(const RuntimePool&) -> RuntimePool& = delete;
+
+    ~RuntimePool() override {
+        destroyRange(buffer, count);
+        ::operator delete(buffer, std::align_val_t(info.align));
+    }
+
+    auto at(std::size_t e) -> std::byte* { return buffer + e * elemSize; }
+
+    auto destroyRange(std::byte *base, std::size_t n) -> void {
+        if (info.destroy) {
+            for (std::size_t i = 0; i < n; ++i) {
+                info.destroy(base + i * elemSize);
             }
-            ++idx;
-        }()), ...);
+        }
+    }
 
-        if (!match) {
-            continue;
+    auto copyElement(std::byte *dst, const std::byte *src) -> void {
+        if (info.copy) {
+            info.copy(dst, src);
+        } else {
+            // Only the component's own bytes; the source may be a caller's object
+            std::memcpy(dst, src, info.size);
         }
+    }
 
-        // Invoke user function with unpacked ptrs
-        invoke_query<Ts...>(e, f, ptrs, std::index_sequence_for<Ts...>{});
+    auto grow(std::size_t newCap) -> void {
+        auto *fresh = static_cast<std::byte*>(::operator new(newCap * elemSize, std::align_val_t(info.align)));
+        for (std::size_t i = 0; i < count; ++i) {
+            if (info.construct) {
+                info.construct(fresh + i * elemSize);
+            }
+            copyElement(fresh + i * elemSize, at(i));
+        }
+        destroyRange(buffer, count);
+        ::operator delete(buffer, std::align_val_t(info.align));
+        buffer   = fresh;
+        capacity = newCap;
     }
-}
 
-} // namespace ec
+    auto reserve(std::size_t n) -> void override {
+        if (n > capacity) {
+            grow(n);
+        }
+        mask.reserve(n);
+    }
+
+    auto ensureSize(std::size_t n) -> void override {
+        if (count >= n) {
+            return;
+        }
+
+        if (n > capacity) {
+            grow(std::max(n, capacity * 2));
+        }
+
+        for (std::size_t i = count; i < n; ++i) {
+            if (info.construct) {
+                info.construct(at(i));
+            } else {
+                std::memset(at(i), 0, elemSize);
+            }
+        }
+        count = n;
+        mask.resize(n, 0);
+    }
+
+    auto rawData() -> void* override {
+        return buffer;
+    }
+
+    auto create() const -> std::unique_ptr<PoolBase> override {
+        return std::make_unique<RuntimePool>(name, typeHash, info);
+    }
+
+    auto assignRaw(std::size_t e, const void *src) -> void override {
+        copyElement(at(e), static_cast<const std::byte*>(src));
+    }
+
+    auto copyRange(const PoolBase &src, std::size_t srcBegin, std::size_t dstBegin, std::size_t n) -> void override {
+        auto &other = static_cast<const RuntimePool&>(src);
+        if (info.copy) {
+            for (std::size_t i = 0; i < n; ++i) {
+                info.copy(at(dstBegin + i), other.buffer + (srcBegin + i) * elemSize);
+            }
+        } else {
+            std::memmove(at(dstBegin), other.buffer + srcBegin * elemSize, n * elemSize);
+        }
+        std::memcpy(mask.data() + dstBegin, src.mask.data() + srcBegin, n);
+    }
+};
+
+// Pooled allocator for coroutine frames, owned by a World.
+// Frames are bucketed into size classes and recycled through free lists.
+struct FrameAllocator {
+    static constexpr std::size_t Granularity = 64;
+    static constexpr std::size_t NumClasses  = 16;
+    static constexpr std::size_t BlockSize   = 16 * 1024;
+
+    struct FreeNode { FreeNode *next; };
+
+    std::array<FreeNode*, NumClasses> freeLists{};
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte *cursor = nullptr;
+    std::byte *end    = nullptr;
+
+    auto allocate(std::size_t n) -> void* {
+        const auto cls = (n + Granularity - 1) / Granularity;
+        if (cls > NumClasses) {
+            return ::operator new(n);
+        }
+
+        if (auto *node = freeLists[cls - 1]) {
+            freeLists[cls - 1] = node->next;
+            return node;
+        }
+
+        const auto bytes = cls * Granularity;
+        if (static_cast<std::size_t>(end - cursor) < bytes) {
+            blocks.push_back(std::make_unique<std::byte[]>(BlockSize));
+            cursor = blocks.back().get();
+            end    = cursor + BlockSize;
+        }
+
+        auto *p = cursor;
+        cursor += bytes;
+        return p;
+    }
+
+    auto deallocate(void *p, std::size_t n) -> void {
+        const auto cls = (n + Granularity - 1) / Granularity;
+        if (cls > NumClasses) {
+            ::operator delete(p);
+            return;
+        }
+
+        auto *node = static_cast<FreeNode*>(p);
+        node->next = freeLists[cls - 1];
+        freeLists[cls - 1] = node;
+    }
+};
+
+// Completion counter a coroutine can co_await; safe to signal from any thread
+struct JobCounter {
+    std::atomic<std::uint32_t> pending{0};
+
+    auto add(std::uint32_t n = 1) -> void { pending.fetch_add(n, std::memory_order_relaxed); }
+    auto done() -> void { pending.fetch_sub(1, std::memory_order_acq_rel); }
+    auto finished() const -> bool { return pending.load(std::memory_order_acquire) == 0; }
+
+    auto operator co_await() const;
+};
+
+// Suspended coroutines of a World, resumed in one batch per tick
+struct Scheduler {
+    std::vector<std::coroutine_handle<>> ready;
+    std::vector<std::coroutine_handle<>> resuming;
+    std::vector<std::pair<std::coroutine_handle<>, const JobCounter*>> waiting;
+
+    Scheduler() = default;
+    Scheduler(const Scheduler&) = delete;
+    Scheduler(Scheduler&&) = default;
+    auto operator=(const Scheduler&) -> Scheduler& = delete;
+    auto operator=(Scheduler&&) -> Scheduler& = default;
+
+    ~Scheduler() {
+        for (auto h : ready) {
+            h.destroy();
+        }
+        for (auto &[h, counter] : waiting) {
+            h.destroy();
+        }
+    }
+};
+
+// Index of the pool worker running on this thread, NullWorker elsewhere
+inline constexpr std::size_t NullWorker = std::numeric_limits<std::size_t>::max();
+inline thread_local std::size_t currentWorker = NullWorker;
+
+// API trace recording, compiled in with EC_TRACE. While World::trace points
+// at a recorder, entity/component calls and queries are appended to a compact
+// binary trace (LEB128 varints, time deltas in ns). Not thread-safe: calls
+// made on ThreadPool workers (par_query bodies, atomic_add, jobs) are skipped.
+enum class TraceOp : std::uint8_t { Create, Destroy, Add, Remove, Get, Query, DefineType };
+inline constexpr std::size_t TraceOpCount = 6;
+inline constexpr char TraceFileMagic[8] = {'E', 'C', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TraceType {
+    std::size_t hash;
+    std::size_t size;
+    std::size_t align;
+    const char *name;
+};
+
+template<typename T>
+inline auto trace_type() -> TraceType {
+    using U = std::remove_const_t<T>;
+    return {typeid(U).hash_code(), sizeof(U), alignof(U), typeid(U).name()};
+}
+
+inline auto put_varint(std::vector<std::uint8_t> &out, std::uint64_t v) -> void {
+    while (v >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+inline auto get_varint(std::span<const std::uint8_t> in, std::size_t &pos, std::uint64_t &v) -> bool {
+    v = 0;
+    for (unsigned shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        const auto byte = in[pos++];
+        v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct TraceRecorder {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::uint8_t> bytes;
+    std::unordered_map<std::size_t, std::uint32_t> types;
+    Clock::time_point last = Clock::now();
+
+    // Trace-local index of a type, defining it in the stream on first use
+    auto typeIndex(const TraceType &t) -> std::uint32_t {
+        auto it = types.find(t.hash);
+        if (it != types.end()) {
+            return it->second;
+        }
+
+        const auto idx = static_cast<std::uint32_t>(types.size());
+        types.emplace(t.hash, idx);
+
+        const std::string_view name = t.name;
+        bytes.push_back(static_cast<std::uint8_t>(TraceOp::DefineType));
+        put_varint(bytes, t.size);
+        put_varint(bytes, t.align);
+        put_varint(bytes, name.size());
+        bytes.insert(bytes.end(), name.begin(), name.end());
+        return idx;
+    }
+
+    auto record(TraceOp op, Entity e, std::span<const std::uint32_t> typeIdx,
+                Clock::time_point start, Clock::time_point end) -> void {
+        auto ns = [](Clock::duration d) {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        };
+
+        bytes.push_back(static_cast<std::uint8_t>(op));
+        put_varint(bytes, start > last ? ns(start - last) : 0);
+        put_varint(bytes, ns(end - start));
+        last = start;
+
+        if (op == TraceOp::Query) {
+            put_varint(bytes, typeIdx.size());
+        } else {
+            put_varint(bytes, e);
+        }
+        for (auto idx : typeIdx) {
+            put_varint(bytes, idx);
+        }
+    }
+};
+
+// Times one API call and records it when the scope ends
+struct TraceScope {
+    static constexpr std::size_t MaxTypes = 16;
+
+    TraceRecorder *rec;
+    TraceOp op;
+    Entity entity;
+    std::array<std::uint32_t, MaxTypes> typeIdx{};
+    std::size_t typeCount = 0;
+    TraceRecorder::Clock::time_point start;
+
+    TraceScope(TraceRecorder *r, TraceOp o, Entity e, std::initializer_list<TraceType> ts)
+        : rec(currentWorker == NullWorker ? r : nullptr), op(o), entity(e) {
+        if (rec) {
+            for (auto &t : ts) {
+                if (typeCount < MaxTypes) {
+                    typeIdx[typeCount++] = rec->typeIndex(t);
+                }
+            }
+            start = TraceRecorder::Clock::now();
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    auto operator=(const TraceScope&) -> TraceScope& = delete;
+
+    ~TraceScope() {
+        if (rec) {
+            rec->record(op, entity, std::span<const std::uint32_t>(typeIdx.data(), typeCount),
+                        start, TraceRecorder::Clock::now());
+        }
+    }
+};
+
+#if defined(EC_TRACE)
+#define EC_TRACE_SCOPE(w, op, e, ...) ::ec::TraceScope ecTraceScope((w).trace, (op), (e), {__VA_ARGS__})
+#define EC_TRACE_RESULT(e) (ecTraceScope.entity = (e))
+#else
+#define EC_TRACE_SCOPE(w, op, e, ...)
+#define EC_TRACE_RESULT(e)
+#endif
+
+// Debug access validator. A system declares the components it reads (const T)
+// and writes (T); while its ScopedAccess is active on a thread, any typed
+// access outside that declaration calls accessViolation, which traps by
+// default. Enabled unless NDEBUG; EC_VALIDATE=0/1 overrides. Compiled out
+// entirely when disabled.
+#if !defined(EC_VALIDATE)
+#if defined(NDEBUG)
+#define EC_VALIDATE 0
+#else
+#define EC_VALIDATE 1
+#endif
+#endif
+
+struct AccessSet {
+    const char *system = "";
+    std::vector<std::size_t> reads;
+    std::vector<std::size_t> writes;
+
+    auto allows(std::size_t hash, bool write) const -> bool {
+        if (std::find(writes.begin(), writes.end(), hash) != writes.end()) {
+            return true;
+        }
+        return !write && std::find(reads.begin(), reads.end(), hash) != reads.end();
+    }
+};
+
+// Declaration of a system's component access: const types are read-only
+template<typename... Ts>
+inline auto declare_access(const char *system = "") -> AccessSet {
+    AccessSet set;
+    set.system = system;
+    ((std::is_const_v<Ts> ? set.reads : set.writes).push_back(typeid(Ts).hash_code()), ...);
+    return set;
+}
+
+inline thread_local const AccessSet *currentAccess = nullptr;
+
+inline auto default_access_violation(const AccessSet &set, const char *type, bool write) -> void {
+    std::fprintf(stderr, "ec: system '%s' %s undeclared component %s\n",
+                 set.system, write ? "writes" : "reads", type);
+    std::abort();
+}
+
+inline void (*accessViolation)(const AccessSet&, const char*, bool) = default_access_violation;
+
+inline auto check_access(std::size_t hash, const char *type, bool write) -> void {
+    if (currentAccess && !currentAccess->allows(hash, write)) {
+        accessViolation(*currentAccess, type, write);
+    }
+}
+
+// Activates a declaration on this thread for the lifetime of the scope
+struct ScopedAccess {
+    const AccessSet *previous;
+
+    explicit ScopedAccess(const AccessSet *set) : previous(currentAccess) { currentAccess = set; }
+    ScopedAccess(const ScopedAccess&) = delete;
+    auto operator=(const ScopedAccess&) -> ScopedAccess& = delete;
+    ~ScopedAccess() { currentAccess = previous; }
+};
+
+#if EC_VALIDATE
+#define EC_CHECK_ACCESS(hash, name, write) ::ec::check_access((hash), (name), (write))
+#define EC_CHECK_TYPE_ACCESS(T) EC_CHECK_ACCESS(typeid(T).hash_code(), typeid(T).name(), !std::is_const_v<T>)
+#else
+#define EC_CHECK_ACCESS(hash, name, write) ((void)0)
+#define EC_CHECK_TYPE_ACCESS(T) ((void)sizeof(T*))
+#endif
+
+// Per-field access counting for hot/cold analysis. Access fields through
+// EC_FIELD(ptr, member); with EC_FIELD_STATS defined every access bumps a
+// counter, otherwise it is a plain member access. field_report() then lists,
+// per component, the fields accessed rarely enough to move into a Split cold
+// part.
+struct FieldStat {
+    const char *type;
+    const char *field;
+    std::size_t size;
+    std::atomic<std::uint64_t> count{0};
+};
+
+inline auto field_stats() -> std::vector<FieldStat*>& {
+    static std::vector<FieldStat*> stats;
+    return stats;
+}
+
+inline auto field_stats_mutex() -> std::mutex& {
+    static std::mutex m;
+    return m;
+}
+
+template<auto Field, typename T>
+inline auto field_stat(const char *name) -> FieldStat& {
+    static FieldStat *stat = [&] {
+        auto *s = new FieldStat{typeid(T).name(), name, sizeof(std::declval<T&>().*Field), {}};
+        std::lock_guard lock(field_stats_mutex());
+        field_stats().push_back(s);
+        return s;
+    }();
+    return *stat;
+}
+
+template<auto Field, typename T>
+inline auto field(T *comp, [[maybe_unused]] const char *name) -> decltype(auto) {
+#if defined(EC_FIELD_STATS)
+    field_stat<Field, std::remove_const_t<T>>(name).count.fetch_add(1, std::memory_order_relaxed);
+#endif
+    return (comp->*Field);
+}
+
+#define EC_FIELD(ptr, member) \
+    (::ec::field<&std::remove_cvref_t<decltype(*(ptr))>::member>((ptr), #member))
+
+struct FieldAdvice {
+    std::string type;
+    std::vector<std::string> hot;
+    std::vector<std::string> cold;
+    std::size_t hotBytes = 0;
+    std::size_t coldBytes = 0;
+};
+
+// Group counted fields by component: a field is cold when it was accessed less
+// than coldRatio times as often as the component's busiest field. Components
+// without cold fields are omitted. Fields never accessed are not listed.
+inline auto field_report(double coldRatio = 0.1) -> std::vector<FieldAdvice> {
+    std::lock_guard lock(field_stats_mutex());
+    std::vector<FieldAdvice> report;
+    std::unordered_map<std::string_view, std::uint64_t> busiest;
+    for (auto *s : field_stats()) {
+        auto &max = busiest[s->type];
+        max = std::max(max, s->count.load(std::memory_order_relaxed));
+    }
+
+    for (auto [type, max] : busiest) {
+        FieldAdvice advice;
+        advice.type = type;
+        for (auto *s : field_stats()) {
+            if (s->type != type) {
+                continue;
+            }
+            const auto count = s->count.load(std::memory_order_relaxed);
+            const bool cold = static_cast<double>(count) < coldRatio * static_cast<double>(max);
+            (cold ? advice.cold : advice.hot).push_back(s->field);
+            (cold ? advice.coldBytes : advice.hotBytes) += s->size;
+        }
+        if (!advice.cold.empty()) {
+            report.push_back(std::move(advice));
+        }
+    }
+    return report;
+}
+
+inline auto reset_field_stats() -> void {
+    std::lock_guard lock(field_stats_mutex());
+    for (auto *s : field_stats()) {
+        s->count.store(0, std::memory_order_relaxed);
+    }
+}
+
+struct World {
+    // Alive flags per entity
+    std::vector<char> alive;
+    Entity nextEntity = 0;
+
+    // Type-erased component pools
+    std::vector<std::unique_ptr<PoolBase>> pools;
+
+    // Map: type hash -> compact ID
+    std::unordered_map<std::size_t, std::size_t> typeMap;
+    std::size_t typeCounter = 0;
+
+    // Limit in bytes for alive flags, masks and component data; 0 means none.
+    // With a budget, slots are reserved explicitly up to it and growth past it
+    // fails instead of reallocating.
+    std::size_t memoryBudget = 0;
+
+    // Bumped whenever alive flags or pool storage may have moved, so loops
+    // holding raw pointers know to re-resolve them
+    std::uint64_t structure = 0;
+
+    // Queries iterating this world right now. Adaptive pools don't switch
+    // layout under a running query; the switch is marked pending and done
+    // when the outermost query returns. par_query workers are covered by the
+    // calling thread's count while parallelQuery is set.
+    std::uint32_t queryDepth = 0;
+    bool parallelQuery = false;
+    bool adaptPending = false;
+
+#if defined(EC_TRACE)
+    // Recorder receiving API calls, if any
+    TraceRecorder *trace = nullptr;
+#endif
+
+    // Coroutine systems; declared last so frames die before the rest of the world
+    FrameAllocator frames;
+    Scheduler scheduler;
+
+    World(std::size_t entityCap = 16, std::size_t compCap = 8) {
+        alive.reserve(entityCap);
+        pools.reserve(compCap);
+        typeMap.reserve(compCap);
+    }
+
+    // Get or assign an ID for component type T
+    template<typename T>
+    auto getTypeId() -> std::size_t {
+        static_assert(std::is_standard_layout_v<T>, "Component must be standard-layout");
+        return getTypeId(typeid(T).hash_code());
+    }
+
+    // ID of component type T if registered, NullType otherwise. Never allocates,
+    // so lookups from get/remove/query stay off the heap.
+    template<typename T>
+    auto findTypeId() const -> std::size_t {
+        static_assert(std::is_standard_layout_v<T>, "Component must be standard-layout");
+        auto it = typeMap.find(typeid(T).hash_code());
+        return it != typeMap.end() ? it->second : NullType;
+    }
+
+    // Pool of component type T if it exists, nullptr otherwise. Never allocates.
+    template<typename T>
+    auto findPool() const -> storage_t<T>* {
+        const auto tid = findTypeId<T>();
+        if (tid == NullType || !pools[tid]) {
+            return nullptr;
+        }
+        return static_cast<storage_t<T>*>(pools[tid].get());
+    }
+
+    // Get or assign an ID for a type hash
+    auto getTypeId(std::size_t hash) -> std::size_t {
+        auto it = typeMap.find(hash);
+        if (it != typeMap.end()) {
+            return it->second;
+        }
+
+        const auto id = typeCounter++;
+        typeMap.emplace(hash, id);
+
+        if (id >= pools.size()) {
+            pools.resize(id + 1);
+        }
+
+        return id;
+    }
+
+    // Bytes one entity slot costs across alive flags and all pools
+    auto slotBytes() const -> std::size_t {
+        std::size_t bytes = 1;
+        for (auto &bp : pools) {
+            if (bp) {
+                bytes += bp->slotBytes();
+            }
+        }
+        return bytes;
+    }
+
+    // Whether slots entity slots, each extra bytes larger, fit the budget
+    auto withinBudget(std::size_t slots, std::size_t extra = 0) const -> bool {
+        return memoryBudget == 0 || slots * (slotBytes() + extra) <= memoryBudget;
+    }
+
+    auto reserveSlots(std::size_t n) -> void {
+        ++structure;
+        alive.reserve(n);
+        for (auto &bp : pools) {
+            if (bp) {
+                bp->reserve(n);
+            }
+        }
+    }
+
+    // Grow to hold entity e; false if that would exceed the memory budget
+    auto ensureEntity(std::size_t e) -> bool {
+        if (e < alive.size()) {
+            return true;
+        }
+        if (memoryBudget != 0 && e >= alive.capacity()) {
+            const auto cap = std::min(std::max(e + 1, alive.capacity() * 2), memoryBudget / slotBytes());
+            if (e >= cap) {
+                return false;
+            }
+            reserveSlots(cap);
+        }
+
+        ++structure;
+        alive.resize(e + 1, 0);
+        for (auto &bp : pools) {
+            if (bp) {
+                bp->ensureSize(e + 1);
+            }
+        }
+        return true;
+    }
+
+    // Install a new pool for typeId. Every pool is created through here, so
+    // the memory budget is checked once: nullptr if the pool's slots don't fit.
+    auto addPool(std::size_t typeId, std::unique_ptr<PoolBase> pool) -> PoolBase* {
+        if (!withinBudget(alive.capacity(), pool->slotBytes())) {
+            return nullptr;
+        }
+
+        // New pools match the planned entity capacity up front
+        pool->reserve(alive.capacity());
+        pool->ensureSize(alive.size());
+        pools[typeId] = std::move(pool);
+        return pools[typeId].get();
+    }
+
+    // Pool in this world holding the same component type as a pool of another
+    // world; nullptr if it has to be created and exceeds the budget
+    auto matchPool(const PoolBase &other) -> PoolBase* {
+        const auto tid = getTypeId(other.typeHash);
+        return pools[tid] ? pools[tid].get() : addPool(tid, other.create());
+    }
+
+    // Ensure pool for typeId exists and sized; nullptr if over the budget
+    template<typename T>
+    auto ensurePool(std::size_t typeId) -> storage_t<T>* {
+        if (!pools[typeId] && !addPool(typeId, std::make_unique<storage_t<T>>())) {
+            return nullptr;
+        }
+
+        auto *pl = static_cast<storage_t<T>*>(pools[typeId].get());
+        pl->ensureSize(alive.size());
+
+        return pl;
+    }
+};
+
+inline auto create_entity(World &w) -> Entity {
+    EC_TRACE_SCOPE(w, TraceOp::Create, NullEntity);
+    if (!w.ensureEntity(w.nextEntity)) {
+        return NullEntity;
+    }
+    const auto id = w.nextEntity++;
+    EC_TRACE_RESULT(id);
+    w.alive[id] = 1;
+    return id;
+}
+
+// Remove every entity and component. Only flags below the high-water mark are
+// written; pools, type IDs and all capacity are kept, so the next fill of a
+// reused world does not allocate. Spawned tasks are left untouched.
+inline auto clear(World &w) -> void {
+    const auto n = static_cast<std::size_t>(w.nextEntity);
+    std::memset(w.alive.data(), 0, std::min(n, w.alive.size()));
+    for (auto &bp : w.pools) {
+        if (bp) {
+            bp->clear(n);
+        }
+    }
+    w.nextEntity = 0;
+}
+
+// Let adaptive pools switch between dense and sparse layouts. Adds and
+// removes do this on their own; call it directly after bulk writes through
+// rawData(). Never call it from inside a query.
+inline auto adapt(World &w) -> void {
+    w.adaptPending = false;
+    for (auto &bp : w.pools) {
+        if (bp && bp->adapt()) {
+            ++w.structure;
+        }
+    }
+}
+
+// Re-check one pool's layout after its occupancy changed; deferred while a
+// query is running
+inline auto adapt_pool(World &w, PoolBase &pool) -> void {
+    if (w.queryDepth != 0) {
+        w.adaptPending = true;
+    } else if (pool.adapt()) {
+        ++w.structure;
+    }
+}
+
+// Held by a query while it iterates; the outermost one runs deferred layout
+// switches on the way out
+struct QueryScope {
+    World &w;
+    bool counted;
+
+    explicit QueryScope(World &world) : w(world), counted(!world.parallelQuery) {
+        if (counted) {
+            ++w.queryDepth;
+        }
+    }
+
+    QueryScope(const QueryScope&) = delete;
+    auto operator=(const QueryScope&) -> QueryScope& = delete;
+
+    ~QueryScope() {
+        if (counted && --w.queryDepth == 0 && w.adaptPending) {
+            adapt(w);
+        }
+    }
+};
+
+// Marks the world as iterated by par_query workers for the scope's lifetime
+struct ParallelScope {
+    QueryScope query;
+    bool outer;
+
+    explicit ParallelScope(World &w) : query(w), outer(!w.parallelQuery) {
+        w.parallelQuery = true;
+    }
+
+    ParallelScope(const ParallelScope&) = delete;
+    auto operator=(const ParallelScope&) -> ParallelScope& = delete;
+
+    // Call after the workers have finished
+    auto end() -> void {
+        if (outer) {
+            query.w.parallelQuery = false;
+            outer = false;
+        }
+    }
+
+    ~ParallelScope() { end(); }
+};
+
+// Preallocate alive flags and every pool for n entities, so growing up to n
+// never reallocates; pools created later reserve the same capacity. Fails
+// without allocating if n slots would exceed the memory budget.
+inline auto reserve_entities(World &w, std::size_t n) -> Status {
+    if (!w.withinBudget(n)) {
+        return Status::ERROR;
+    }
+    w.reserveSlots(n);
+    return Status::OK;
+}
+
+// Create T's pool if needed and preallocate it for n entity slots
+template<typename T>
+inline auto reserve(World &w, std::size_t n) -> Status {
+    const auto tid   = w.getTypeId<T>();
+    const auto extra = w.pools[tid] ? 0 : storage_t<T>().slotBytes();
+    if (!w.withinBudget(std::max(n, w.alive.capacity()), extra)) {
+        return Status::ERROR;
+    }
+    auto *pool = w.ensurePool<T>(tid);
+    if (!pool) {
+        return Status::ERROR;
+    }
+    pool->reserve(n);
+    ++w.structure;
+    return Status::OK;
+}
+
+// Drop resident pages of T's pool if its storage is file-backed (MappedPool)
+template<typename T>
+inline auto evict(World &w) -> void {
+    if (auto *pool = w.findPool<T>()) {
+        pool->evict();
+    }
+}
+
+inline auto destroy_entity(World &w, Entity e) -> void {
+    EC_TRACE_SCOPE(w, TraceOp::Destroy, e);
+    if (e < w.alive.size()) {
+        w.alive[e] = 0;
+    }
+}
+
+// Add a component: validates, finds pool, stores data
+template<typename T>
+inline auto add_component(World &w, Entity e, const T &comp) -> Status {
+    EC_TRACE_SCOPE(w, TraceOp::Add, e, trace_type<T>());
+    EC_CHECK_TYPE_ACCESS(T);
+
+    // 1. Validate entity
+    if (e >= w.alive.size() || !w.alive[e]) {
+        return Status::ERROR;
+    }
+
+    // 2. Get component-type ID
+    const auto tid  = w.getTypeId<T>();
+
+    // 3. Ensure pool exists (within the memory budget) and is sized;
+    //    partitioned pools reject keys out of range
+    auto *pool = w.ensurePool<T>(tid);
+    if (!pool || !pool->accepts(&comp)) {
+        return Status::ERROR;
+    }
+
+    // 4. Assign data and mark; sparse adaptive pools may move their arrays
+    pool->assign(e, comp);
+    if constexpr (is_adaptive_v<T>) {
+        ++w.structure;
+        adapt_pool(w, *pool);
+    }
+
+    return Status::OK;
+}
+
+// Get a component pointer or nullptr. get_component<const T> is a read-only
+// access as far as the access validator is concerned.
+template<typename T>
+inline auto get_component(World &w, Entity e) -> T* {
+    EC_TRACE_SCOPE(w, TraceOp::Get, e, trace_type<T>());
+    EC_CHECK_TYPE_ACCESS(T);
+    auto *pool = w.findPool<T>();
+    return pool ? pool->get(e) : nullptr;
+}
+
+// Remove a component
+template<typename T>
+inline auto remove_component(World &w, Entity e) -> Status {
+    EC_TRACE_SCOPE(w, TraceOp::Remove, e, trace_type<T>());
+    EC_CHECK_TYPE_ACCESS(T);
+    auto *pool = w.findPool<T>();
+    if (!pool) {
+        return Status::ERROR;
+    }
+
+    if (e < pool->mask.size()) {
+        pool->erase(e);
+        if constexpr (is_adaptive_v<T>) {
+            ++w.structure;
+            adapt_pool(w, *pool);
+        }
+    }
+
+    return Status::OK;
+}
+
+// Split components: each part goes to its own pool
+template<typename T> requires is_split_v<T>
+inline auto add_component(World &w, Entity e, const T &comp) -> Status {
+    if (add_component(w, e, comp.hot) != Status::OK) {
+        return Status::ERROR;
+    }
+    return add_component(w, e, comp.cold);
+}
+
+template<typename T> requires is_split_v<T>
+inline auto get_component(World &w, Entity e) {
+    using Hot  = std::conditional_t<std::is_const_v<T>, const decltype(T::hot), decltype(T::hot)>;
+    using Cold = std::conditional_t<std::is_const_v<T>, const decltype(T::cold), decltype(T::cold)>;
+    auto *hot  = get_component<Hot>(w, e);
+    auto *cold = hot ? get_component<Cold>(w, e) : nullptr;
+    return cold ? SplitPtr<Hot, Cold>{hot, cold} : SplitPtr<Hot, Cold>{};
+}
+
+template<typename T> requires is_split_v<T>
+inline auto remove_component(World &w, Entity e) -> Status {
+    const auto hot  = remove_component<decltype(T::hot)>(w, e);
+    const auto cold = remove_component<decltype(T::cold)>(w, e);
+    return hot == Status::OK && cold == Status::OK ? Status::OK : Status::ERROR;
+}
+
+// Raw mask and data pointers of one pool, resolved once per query
+template<typename T>
+struct QueryView {
+    const char *mask = nullptr;
+    T *data = nullptr;
+
+    auto at(Entity e) const -> T* { return data + e; }
+};
+
+// Adaptive pools add the slot index while sparse; the branch is loop-invariant
+template<typename T> requires is_adaptive_v<T>
+struct QueryView<T> {
+    const char *mask = nullptr;
+    T *data = nullptr;
+    const std::uint32_t *index = nullptr;
+
+    auto at(Entity e) const -> T* { return data + (index ? index[e] : e); }
+};
+
+template<typename T>
+inline auto query_view(World &w) -> QueryView<T> {
+    static_assert(!is_split_v<T>, "Query the hot or cold part of a split component");
+    auto *pool = w.findPool<T>();
+    if (!pool) {
+        return {};
+    }
+    if constexpr (is_adaptive_v<T>) {
+        if (pool->sparse) {
+            return {pool->mask.data(), pool->packed.data(), pool->index.data()};
+        }
+    }
+    return {pool->mask.data(), pool->values()};
+}
+
+// Query restricted to entity IDs in [begin, end). Const component types are
+// passed as const pointers and count as reads for the access validator.
+// Every pool holds at least alive.size() >= nextEntity slots, so the loop
+// indexes masks and data without bounds checks.
+template<typename... Ts, typename Func>
+inline auto query_range(World &w, Entity begin, Entity end, Func f) -> void {
+    (EC_CHECK_TYPE_ACCESS(Ts), ...);
+
+    // No entity can match a type that has never been added
+    if (!(w.findPool<Ts>() && ...)) {
+        return;
+    }
+    QueryScope scope(w);
+
+    // f may create entities and add or remove components, which can move
+    // alive flags and pool storage. After each call the loop compares
+    // World::structure and, if it changed, resumes with freshly resolved views.
+
+    // The smallest sparse adaptive pool drives the loop with its packed owner
+    // list, so the scan costs its size instead of nextEntity. It is walked back
+    // to front: owners appended by f are not visited, and removing another
+    // entity's component from the driving pool swaps an already visited owner
+    // into its slot, which is then visited again. Defer such removals through a
+    // CommandBuffer when every entity must be visited exactly once.
+    if constexpr ((is_adaptive_v<Ts> || ...)) {
+        const std::vector<Entity> *driver = nullptr;
+        ([&] {
+            if constexpr (is_adaptive_v<Ts>) {
+                auto *pool = w.findPool<Ts>();
+                if (pool->sparse && (!driver || pool->entities.size() < driver->size())) {
+                    driver = &pool->entities;
+                }
+            }
+        }(), ...);
+
+        if (driver) {
+            for (auto i = driver->size(); i > 0;) {
+                const auto version = w.structure;
+                i = [&](const char *alive, QueryView<Ts>... views) -> std::size_t {
+                    while (i-- > 0) {
+                        const auto e = (*driver)[i];
+                        if (e >= begin && e < end && alive[e] && (views.mask[e] && ...)) {
+                            f(e, views.at(e)...);
+                            if (w.structure != version) {
+                                return std::min(i, driver->size());
+                            }
+                        }
+                    }
+                    return 0;
+                }(w.alive.data(), query_view<Ts>(w)...);
+            }
+            return;
+        }
+    }
+
+    // Views are taken by value so base pointers stay in registers
+    for (Entity next = begin; next < std::min(end, w.nextEntity);) {
+        const auto version = w.structure;
+        next = [&](const char *alive, Entity last, QueryView<Ts>... views) -> Entity {
+            for (Entity e = next; e < last; ++e) {
+                if (alive[e] && (views.mask[e] && ...)) {
+                    f(e, views.at(e)...);
+                    if (w.structure != version) {
+                        return e + 1;
+                    }
+                }
+            }
+            return last;
+        }(w.alive.data(), std::min(end, w.nextEntity), query_view<Ts>(w)...);
+    }
+}
+
+template<typename... Ts, typename Func>
+inline auto query(World &w, Func f) -> void {
+    EC_TRACE_SCOPE(w, TraceOp::Query, NullEntity, trace_type<Ts>()...);
+    // Open-ended, so entities f creates are visited as well
+    query_range<Ts...>(w, 0, std::numeric_limits<Entity>::max(), f);
+}
+
+// Iterate the entities whose partitioned component P equals value, with
+// f(Entity, P*, Ts*...) for those that also have Ts. P's storage must be a
+// PartitionedPool. Buckets are walked back to front, so moving the current
+// entity to another value from inside f is safe.
+template<typename P, typename... Ts, typename Func>
+inline auto query_partition(World &w, P value, Func f) -> void {
+    EC_CHECK_TYPE_ACCESS(P);
+    (EC_CHECK_TYPE_ACCESS(Ts), ...);
+
+    auto *pool = w.findPool<P>();
+    if (!pool || !(w.findPool<Ts>() && ...) || pool->bucketOf(value) >= pool->buckets.size()) {
+        return;
+    }
+    QueryScope scope(w);
+
+    // Views are re-resolved when f changes the world's structure, as in query_range
+    const auto &bucket = pool->buckets[pool->bucketOf(value)];
+    for (auto i = bucket.size(); i > 0;) {
+        const auto version = w.structure;
+        i = [&](const char *alive, P *data, QueryView<Ts>... views) -> std::size_t {
+            while (i-- > 0) {
+                const auto e = bucket[i];
+                if (alive[e] && (views.mask[e] && ...)) {
+                    f(e, data + e, views.at(e)...);
+                    if (w.structure != version) {
+                        return std::min(i, bucket.size());
+                    }
+                }
+            }
+            return 0;
+        }(w.alive.data(), pool->data.data(), query_view<Ts>(w)...);
+    }
+}
+
+// Half-open slice [begin, end) of the entity ID space
+struct EntityRange {
+    Entity begin;
+    Entity end;
+};
+
+// Split [0, nextEntity) into n contiguous ranges holding about the same number
+// of entities matching Ts, so query_range work can be sharded evenly even when
+// IDs are clustered. Always returns n ranges; some may be empty.
+template<typename... Ts>
+inline auto split_query(World &w, std::size_t n) -> std::vector<EntityRange> {
+    std::vector<EntityRange> ranges;
+    if (n == 0) {
+        return ranges;
+    }
+
+    std::size_t total = 0;
+    query_range<const Ts...>(w, 0, w.nextEntity, [&](Entity, const Ts*...) { ++total; });
+
+    // Cut after the k-th share of matches
+    ranges.reserve(n);
+    std::size_t seen = 0;
+    Entity begin = 0;
+    query_range<const Ts...>(w, 0, w.nextEntity, [&](Entity e, const Ts*...) {
+        ++seen;
+        while (ranges.size() + 1 < n && seen * n >= total * (ranges.size() + 1)) {
+            ranges.push_back({begin, e + 1});
+            begin = e + 1;
+        }
+    });
+    while (ranges.size() + 1 < n) {
+        ranges.push_back({begin, begin});
+    }
+    ranges.push_back({begin, w.nextEntity});
+
+    return ranges;
+}
+
+// Entities per gather/scatter batch in query_batched
+inline constexpr std::size_t QueryBatch = 256;
+
+// Per-thread gather buffer for query_batched, allocated once per type. A
+// query takes it for its duration, so nested queries allocate their own.
+template<typename T>
+inline auto batch_scratch() -> std::vector<T>& {
+    thread_local std::vector<T> buffer;
+    return buffer;
+}
+
+// Gather/pack/scatter query. Components of matching entities are copied into
+// contiguous per-type buffers of up to QueryBatch entries, then
+// kernel(std::span<const Entity>, std::span<Ts>...) runs once per batch and
+// non-const components are scattered back. Lets SIMD kernels run at full
+// width even when matches are sparse. Buffers come from batch_scratch.
+template<typename... Ts, typename Kernel>
+inline auto query_batched(World &w, Kernel kernel) -> void {
+    (EC_CHECK_TYPE_ACCESS(Ts), ...);
+
+    if (!(w.findPool<Ts>() && ...)) {
+        return;
+    }
+    QueryScope scope(w);
+
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        const std::tuple<storage_t<Ts>*...> pools = { w.findPool<Ts>()... };
+        std::array<Entity, QueryBatch> entities;
+        std::tuple<std::vector<std::remove_const_t<Ts>>...> buffers = {
+            std::exchange(batch_scratch<std::remove_const_t<Ts>>(), {})...
+        };
+        (std::get<I>(buffers).resize(QueryBatch), ...);
+        std::size_t n = 0;
+
+        auto flush = [&] {
+            kernel(std::span<const Entity>(entities.data(), n), std::span<Ts>(std::get<I>(buffers).data(), n)...);
+
+            // Scatter written components back
+            ([&] {
+                if constexpr (!std::is_const_v<Ts>) {
+                    auto *pool = std::get<I>(pools);
+                    for (std::size_t k = 0; k < n; ++k) {
+                        pool->assign(entities[k], std::get<I>(buffers)[k]);
+                    }
+                }
+            }(), ...);
+            n = 0;
+        };
+
+        for (Entity e = 0; e < w.nextEntity; ++e) {
+            if (!w.alive[e] || !(std::get<I>(pools)->mask[e] && ...)) {
+                continue;
+            }
+
+            entities[n] = e;
+            ((std::get<I>(buffers)[n] = *std::get<I>(pools)->get(e)), ...);
+            if (++n == QueryBatch) {
+                flush();
+            }
+        }
+
+        if (n > 0) {
+            flush();
+        }
+
+        // Hand the buffers back for the next query on this thread
+        ((batch_scratch<std::remove_const_t<Ts>>() = std::move(std::get<I>(buffers))), ...);
+    }(std::index_sequence_for<Ts...>{});
+}
+
+// Runtime component types share the type map with static ones, keyed by a
+// hash of their name.
+inline auto runtime_type_hash(std::string_view name) -> std::size_t {
+    return std::hash<std::string_view>{}(name) ^ 0x9e3779b97f4a7c15ull;
+}
+
+// Register a component type by name with an explicit layout. Registering an
+// existing name returns its ID; NullType if the pool exceeds the memory budget.
+inline auto register_component(World &w, std::string_view name, const ComponentInfo &info) -> std::size_t {
+    const auto hash = runtime_type_hash(name);
+    const auto tid  = w.getTypeId(hash);
+    if (!w.pools[tid] && !w.addPool(tid, std::make_unique<RuntimePool>(name, hash, info))) {
+        return NullType;
+    }
+    return tid;
+}
+
+// Register a static component type up front and create its pool; NullType
+// if the pool exceeds the memory budget
+template<typename T>
+inline auto register_component(World &w) -> std::size_t {
+    const auto tid = w.getTypeId<T>();
+    return w.ensurePool<T>(tid) ? tid : NullType;
+}
+
+// ID of a registered component by name, static or runtime; NullType if unknown
+inline auto find_component(World &w, std::string_view name) -> std::size_t {
+    for (std::size_t tid = 0; tid < w.pools.size(); ++tid) {
+        if (w.pools[tid] && w.pools[tid]->name == name) {
+            return tid;
+        }
+    }
+    return NullType;
+}
+
+// Untyped access by component ID, for runtime and static types alike
+inline auto add_component(World &w, Entity e, std::size_t tid, const void *comp) -> Status {
+    if (e >= w.alive.size() || !w.alive[e] || tid >= w.pools.size() || !w.pools[tid]) {
+        return Status::ERROR;
+    }
+
+    auto &pool = *w.pools[tid];
+    EC_CHECK_ACCESS(pool.typeHash, pool.name.c_str(), true);
+    if (!pool.accepts(comp)) {
+        return Status::ERROR;
+    }
+    pool.assignRaw(e, comp);
+    pool.mask[e] = 1;
+    ++w.structure;
+    adapt_pool(w, pool);
+
+    return Status::OK;
+}
+
+inline auto get_component(World &w, Entity e, std::size_t tid) -> void* {
+    if (tid >= w.pools.size() || !w.pools[tid]) {
+        return nullptr;
+    }
+
+    auto &pool = *w.pools[tid];
+    EC_CHECK_ACCESS(pool.typeHash, pool.name.c_str(), true);
+    if (e >= pool.mask.size() || !pool.mask[e]) {
+        return nullptr;
+    }
+
+    return pool.rawAt(e);
+}
+
+inline auto remove_component(World &w, Entity e, std::size_t tid) -> Status {
+    if (tid >= w.pools.size() || !w.pools[tid]) {
+        return Status::ERROR;
+    }
+
+    auto &pool = *w.pools[tid];
+    EC_CHECK_ACCESS(pool.typeHash, pool.name.c_str(), true);
+    if (e < pool.mask.size()) {
+        pool.erase(e);
+        ++w.structure;
+        adapt_pool(w, pool);
+    }
+
+    return Status::OK;
+}
+
+// Query by component IDs, mixing static and runtime types.
+// f(Entity, void* const* ptrs) receives one pointer per ID, in order.
+template<typename Func>
+inline auto query_dynamic(World &w, std::span<const std::size_t> types, Func f) -> void {
+    constexpr std::size_t MaxTypes = 16;
+    if (types.empty() || types.size() > MaxTypes) {
+        return;
+    }
+
+    for (auto tid : types) {
+        if (tid >= w.pools.size() || !w.pools[tid]) {
+            return;
+        }
+        EC_CHECK_ACCESS(w.pools[tid]->typeHash, w.pools[tid]->name.c_str(), true);
+    }
+    QueryScope scope(w);
+
+    // Resolve masks, base pointers and strides up front, and again whenever
+    // f changes the world's structure
+    // Non-contiguous (sparse) pools are read per entity and keep their layout
+    std::array<const char*, MaxTypes> masks{};
+    std::array<std::byte*, MaxTypes> bases{};
+    std::array<std::size_t, MaxTypes> strides{};
+    std::array<PoolBase*, MaxTypes> pools{};
+    std::uint64_t version = 0;
+    auto resolve = [&] {
+        for (std::size_t i = 0; i < types.size(); ++i) {
+            auto &pool = *w.pools[types[i]];
+            pools[i]   = &pool;
+            masks[i]   = pool.mask.data();
+            bases[i]   = pool.contiguous() ? static_cast<std::byte*>(pool.rawData()) : nullptr;
+            strides[i] = pool.elemSize;
+        }
+        version = w.structure;
+    };
+    resolve();
+
+    void* ptrs[MaxTypes];
+    for (Entity e = 0; e < w.nextEntity; ++e) {
+        if (!w.alive[e]) {
+            continue;
+        }
+
+        bool match = true;
+        for (std::size_t i = 0; i < types.size() && match; ++i) {
+            match = masks[i][e] != 0;
+            ptrs[i] = !match ? nullptr : bases[i] ? bases[i] + e * strides[i] : pools[i]->rawAt(e);
+        }
+
+        if (match) {
+            f(e, static_cast<void* const*>(ptrs));
+            if (w.structure != version) {
+                resolve();
+            }
+        }
+    }
+}
+
+// Structural changes recorded during iteration and applied later at a sync
+// point, in recording order. Entities created through the buffer get
+// placeholder IDs (PendingEntity bit set) that later commands in the same
+// buffer may use; apply() maps them to real IDs. Components are stored as
+// bytes, so they must be trivially copyable.
+inline constexpr Entity PendingEntity = Entity(1) << 31;
+
+struct CommandBuffer {
+    enum class Op : std::uint8_t { Create, Destroy, Add, Remove };
+
+    struct Command {
+        Op op;
+        Entity entity;
+        std::size_t typeHash;
+        std::size_t (*registerType)(World&);
+        std::size_t offset;
+    };
+
+    std::vector<Command> commands;
+    std::vector<std::byte> payload;
+    std::vector<Entity> created;
+    Entity pending = 0;
+
+    auto create() -> Entity {
+        commands.push_back({Op::Create, pending, 0, nullptr, 0});
+        return PendingEntity | pending++;
+    }
+
+    auto destroy(Entity e) -> void {
+        commands.push_back({Op::Destroy, e, 0, nullptr, 0});
+    }
+
+    template<typename T>
+    auto add(Entity e, const T &comp) -> void {
+        static_assert(std::is_trivially_copyable_v<T>, "Deferred components must be trivially copyable");
+        const auto offset = (payload.size() + alignof(T) - 1) / alignof(T) * alignof(T);
+        payload.resize(offset + sizeof(T));
+        std::memcpy(payload.data() + offset, &comp, sizeof(T));
+
+        // NullType (over budget) makes the add fail when applied
+        auto reg = [](World &w) -> std::size_t { return register_component<T>(w); };
+        commands.push_back({Op::Add, e, typeid(T).hash_code(), +reg, offset});
+    }
+
+    template<typename T>
+    auto remove(Entity e) -> void {
+        commands.push_back({Op::Remove, e, typeid(T).hash_code(), nullptr, 0});
+    }
+
+    auto empty() const -> bool { return commands.empty(); }
+
+    auto clear() -> void {
+        commands.clear();
+        payload.clear();
+        pending = 0;
+    }
+};
+
+// Replay a command buffer into the world and clear it (capacity is kept)
+inline auto apply(World &w, CommandBuffer &cb) -> void {
+    cb.created.resize(cb.pending);
+    auto resolve = [&](Entity e) {
+        return (e & PendingEntity) ? cb.created[e & ~PendingEntity] : e;
+    };
+
+    for (auto &cmd : cb.commands) {
+        switch (cmd.op) {
+        case CommandBuffer::Op::Create:
+            cb.created[cmd.entity] = create_entity(w);
+            break;
+        case CommandBuffer::Op::Destroy:
+            destroy_entity(w, resolve(cmd.entity));
+            break;
+        case CommandBuffer::Op::Add:
+            add_component(w, resolve(cmd.entity), cmd.registerType(w), cb.payload.data() + cmd.offset);
+            break;
+        case CommandBuffer::Op::Remove: {
+            auto it = w.typeMap.find(cmd.typeHash);
+            if (it != w.typeMap.end()) {
+                remove_component(w, resolve(cmd.entity), it->second);
+            }
+            break;
+        }
+        }
+    }
+
+    cb.clear();
+}
+
+// Append all entities of src to dst. Pools are matched by type once and
+// copied as whole blocks. Returns the dst id for each src id (NullEntity for
+// dead entities).
+inline auto merge(World &dst, World &src) -> std::vector<Entity> {
+    const auto count = static_cast<std::size_t>(src.nextEntity);
+    std::vector<Entity> remap(count, NullEntity);
+    if (count == 0 || &src == &dst) {
+        return remap;
+    }
+
+    // Match pools first: a new component type over the budget fails the merge
+    std::vector<std::pair<PoolBase*, const PoolBase*>> matched;
+    for (auto &sp : src.pools) {
+        if (sp) {
+            auto *dp = dst.matchPool(*sp);
+            if (!dp) {
+                return remap;
+            }
+            matched.emplace_back(dp, sp.get());
+        }
+    }
+
+    const auto base = dst.nextEntity;
+    if (!dst.ensureEntity(base + count - 1)) {
+        return remap;
+    }
+    dst.nextEntity += src.nextEntity;
+
+    for (auto [dp, sp] : matched) {
+        dp->copyRange(*sp, 0, base, count);
+        adapt_pool(dst, *dp);
+    }
+
+    std::memcpy(dst.alive.data() + base, src.alive.data(), count);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (src.alive[i]) {
+            remap[i] = base + static_cast<Entity>(i);
+        }
+    }
+
+    return remap;
+}
+
+// Copy the given entities with all their components into dst. Consecutive
+// ids are copied as runs, so sorted input costs one block copy per run and
+// pool. Returns the dst id for each input entity (NullEntity if not alive).
+inline auto copy_entities(World &dst, World &src, std::span<const Entity> es) -> std::vector<Entity> {
+    // Allocate the destination range up front
+    std::vector<Entity> out;
+    out.reserve(es.size());
+    std::size_t count = 0;
+    for (auto e : es) {
+        const bool live = e < src.alive.size() && src.alive[e];
+        out.push_back(live ? dst.nextEntity + static_cast<Entity>(count++) : NullEntity);
+    }
+    if (count == 0) {
+        return out;
+    }
+
+    // Match pools first: a new component type over the budget fails the copy
+    std::vector<std::pair<PoolBase*, const PoolBase*>> matched;
+    for (auto &sp : src.pools) {
+        if (sp) {
+            auto *dp = dst.matchPool(*sp);
+            if (!dp) {
+                out.assign(es.size(), NullEntity);
+                return out;
+            }
+            matched.emplace_back(dp, sp.get());
+        }
+    }
+
+    if (!dst.ensureEntity(dst.nextEntity + count - 1)) {
+        out.assign(es.size(), NullEntity);
+        return out;
+    }
+    dst.nextEntity += static_cast<Entity>(count);
+
+    // Copy pool by pool, one block per run of consecutive ids
+    for (auto [dp, sp] : matched) {
+        for (std::size_t i = 0; i < es.size();) {
+            if (out[i] == NullEntity) {
+                ++i;
+                continue;
+            }
+
+            std::size_t run = 1;
+            while (i + run < es.size() && out[i + run] != NullEntity && es[i + run] == es[i] + run) {
+                ++run;
+            }
+            dp->copyRange(*sp, es[i], out[i], run);
+            i += run;
+        }
+        adapt_pool(dst, *dp);
+    }
+
+    for (auto e : out) {
+        if (e != NullEntity) {
+            dst.alive[e] = 1;
+        }
+    }
+
+    return out;
+}
+
+// Move entities with all their components from src to dst in one batch.
+// Pools are matched by component type once per call, so the worlds may have
+// registered their types in any order. out receives the new id in dst for
+// each input entity (NullEntity for entities that are not alive in src).
+inline auto migrate_entities(World &src, World &dst, std::span<const Entity> es, std::vector<Entity> &out) -> Status {
+    if (&src == &dst) {
+        return Status::ERROR;
+    }
+
+    out = copy_entities(dst, src, es);
+    for (std::size_t i = 0; i < es.size(); ++i) {
+        if (out[i] == NullEntity && es[i] < src.alive.size() && src.alive[es[i]]) {
+            return Status::ERROR;
+        }
+    }
+
+    // Entities leave src entirely
+    for (std::size_t i = 0; i < es.size(); ++i) {
+        if (out[i] == NullEntity) {
+            continue;
+        }
+        for (auto &sp : src.pools) {
+            if (sp) {
+                sp->erase(es[i]);
+            }
+        }
+        src.alive[es[i]] = 0;
+    }
+    ++src.structure;
+    for (auto &sp : src.pools) {
+        if (sp) {
+            adapt_pool(src, *sp);
+        }
+    }
+
+    return Status::OK;
+}
+
+inline auto migrate_entity(World &src, World &dst, Entity e) -> Entity {
+    std::vector<Entity> out;
+    migrate_entities(src, dst, std::span<const Entity>(&e, 1), out);
+    return out.empty() ? NullEntity : out[0];
+}
+
+// Stable id of an entity across shards; travels with the entity on migration
+struct GlobalId { std::uint64_t id; };
+inline constexpr std::uint64_t NullGlobal = std::numeric_limits<std::uint64_t>::max();
+
+// One World per shard plus the global id -> (shard, entity) mapping.
+// Shards share nothing while they run; rebalance() is the sync point.
+struct ShardSet {
+    struct Location { std::size_t shard; Entity entity; };
+
+    std::vector<std::unique_ptr<World>> shards;
+    std::unordered_map<std::uint64_t, Location> locations;
+    std::uint64_t nextGlobal = 0;
+
+    explicit ShardSet(std::size_t n) {
+        shards.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            shards.push_back(std::make_unique<World>());
+        }
+    }
+};
+
+// Create an entity in a shard and give it a global id; NullGlobal if the
+// shard is out of range or its world can't grow (memory budget)
+inline auto create_entity(ShardSet &set, std::size_t shard) -> std::uint64_t {
+    if (shard >= set.shards.size()) {
+        return NullGlobal;
+    }
+    auto &w = *set.shards[shard];
+    const auto e = create_entity(w);
+    if (e == NullEntity) {
+        return NullGlobal;
+    }
+    const auto gid = set.nextGlobal;
+    if (add_component<GlobalId>(w, e, {gid}) != Status::OK) {
+        destroy_entity(w, e);
+        return NullGlobal;
+    }
+    ++set.nextGlobal;
+    set.locations[gid] = {shard, e};
+    return gid;
+}
+
+// Destroy a sharded entity and forget its global id
+inline auto destroy_entity(ShardSet &set, std::uint64_t gid) -> Status {
+    auto it = set.locations.find(gid);
+    if (it == set.locations.end()) {
+        return Status::ERROR;
+    }
+    destroy_entity(*set.shards[it->second.shard], it->second.entity);
+    set.locations.erase(it);
+    return Status::OK;
+}
+
+inline auto locate(const ShardSet &set, std::uint64_t gid) -> const ShardSet::Location* {
+    auto it = set.locations.find(gid);
+    return it != set.locations.end() ? &it->second : nullptr;
+}
+
+// Migrate every entity whose region changed. shardOf maps a T (e.g. a
+// position) to the shard owning that region. moved receives the number
+// moved; on a failed batch (memory budget) the remaining batches are left
+// in place, locations stay correct, and the result is Status::ERROR.
+template<typename T, typename ShardOf>
+inline auto rebalance(ShardSet &set, ShardOf shardOf, std::size_t &moved) -> Status {
+    const auto n = set.shards.size();
+
+    // outgoing[from * n + to] = entities crossing from -> to
+    std::vector<std::vector<Entity>> outgoing(n * n);
+    for (std::size_t from = 0; from < n; ++from) {
+        query<T>(*set.shards[from], [&](Entity e, T *c) {
+            const auto to = static_cast<std::size_t>(shardOf(*c));
+            if (to != from && to < n) {
+                outgoing[from * n + to].push_back(e);
+            }
+        });
+    }
+
+    moved = 0;
+    std::vector<Entity> out;
+    for (std::size_t from = 0; from < n; ++from) {
+        for (std::size_t to = 0; to < n; ++to) {
+            auto &batch = outgoing[from * n + to];
+            if (batch.empty()) {
+                continue;
+            }
+
+            auto &dst = *set.shards[to];
+            if (migrate_entities(*set.shards[from], dst, batch, out) != Status::OK) {
+                return Status::ERROR;
+            }
+            for (auto e : out) {
+                if (e == NullEntity) {
+                    continue;
+                }
+                if (auto *gid = get_component<GlobalId>(dst, e)) {
+                    set.locations[gid->id] = {to, e};
+                }
+                ++moved;
+            }
+        }
+    }
+
+    return Status::OK;
+}
+
+// Coroutine system. Frames come from the World's FrameAllocator when the
+// coroutine takes World& as its first parameter, otherwise from the heap.
+// A World must not be moved while it owns suspended coroutines.
+struct Task {
+    // State and behaviour shared by both promise types
+    struct Promise {
+        World *world = nullptr;
+
+        auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        auto return_void() -> void {}
+        auto unhandled_exception() -> void { std::terminate(); }
+    };
+
+    // Header in front of every frame records the allocator it came from
+    static constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+
+    static auto allocateFrame(std::size_t n, FrameAllocator *alloc) -> void* {
+        auto *p = static_cast<std::byte*>(alloc ? alloc->allocate(n + HeaderSize) : ::operator new(n + HeaderSize));
+        *reinterpret_cast<FrameAllocator**>(p) = alloc;
+        return p + HeaderSize;
+    }
+
+    static auto freeFrame(void *ptr, std::size_t n) -> void {
+        auto *p = static_cast<std::byte*>(ptr) - HeaderSize;
+        if (auto *alloc = *reinterpret_cast<FrameAllocator**>(p)) {
+            alloc->deallocate(p, n + HeaderSize);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    // Heap frames, for coroutines without a World& first parameter
+    struct promise_type : Promise {
+        static auto operator new(std::size_t n) -> void* { return allocateFrame(n, nullptr); }
+        static auto operator delete(void *ptr, std::size_t n) -> void { freeFrame(ptr, n); }
+        auto get_return_object() -> Task { return Task(*this); }
+    };
+
+    // Pooled frames, selected through coroutine_traits (end of file) for
+    // coroutines taking World& first. A class template rather than a template
+    // operator new keeps new and delete a plain pair in one class, which is
+    // what GCC's -Wmismatched-new-delete checks.
+    template<typename... Args>
+    struct WorldPromise : Promise {
+        static auto operator new(std::size_t n, World &w, Args&...) -> void* { return allocateFrame(n, &w.frames); }
+        static auto operator delete(void *ptr, std::size_t n) -> void { freeFrame(ptr, n); }
+        auto get_return_object() -> Task { return Task(*this); }
+    };
+
+    std::coroutine_handle<> handle;
+    Promise *promise = nullptr;
+
+    template<typename P>
+    explicit Task(P &p) : handle(std::coroutine_handle<P>::from_promise(p)), promise(&p) {}
+    Task(Task &&o) noexcept : handle(std::exchange(o.handle, nullptr)), promise(o.promise) {}
+    Task(const Task&) = delete;
+    auto operator=(const Task&) -> Task& = delete;
+    auto operator=(Task&&) -> Task& = delete;
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+};
+
+// Awaitable: suspend until the next tick(world)
+struct NextTick {
+    auto await_ready() const noexcept -> bool { return false; }
+    template<typename P>
+    auto await_suspend(std::coroutine_handle<P> h) const -> void {
+        h.promise().world->scheduler.ready.push_back(h);
+    }
+    auto await_resume() const noexcept -> void {}
+};
+
+inline auto next_tick() -> NextTick {
+    return {};
+}
+
+// Awaitable: suspend until a JobCounter finishes
+struct CounterWait {
+    const JobCounter *counter;
+
+    auto await_ready() const noexcept -> bool { return counter->finished(); }
+    template<typename P>
+    auto await_suspend(std::coroutine_handle<P> h) const -> void {
+        h.promise().world->scheduler.waiting.emplace_back(h, counter);
+    }
+    auto await_resume() const noexcept -> void {}
+};
+
+inline auto JobCounter::operator co_await() const {
+    return CounterWait{this};
+}
+
+// Hand a coroutine to the world; it starts on the next tick
+inline auto spawn(World &w, Task t) -> void {
+    t.promise->world = &w;
+    w.scheduler.ready.push_back(std::exchange(t.handle, nullptr));
+}
+
+// Resume every coroutine that is due this tick, in one batch
+inline auto tick(World &w) -> void {
+    auto &s = w.scheduler;
+    std::swap(s.ready, s.resuming);
+
+    // Collect waiters whose job finished, keep the rest parked
+    std::size_t kept = 0;
+    for (auto &entry : s.waiting) {
+        if (entry.second->finished()) {
+            s.resuming.push_back(entry.first);
+        } else {
+            s.waiting[kept++] = entry;
+        }
+    }
+    s.waiting.erase(s.waiting.begin() + static_cast<std::ptrdiff_t>(kept), s.waiting.end());
+
+    for (auto h : s.resuming) {
+        h.resume();
+    }
+    s.resuming.clear();
+}
+
+// Work-stealing thread pool. Each worker owns a deque: it pops its own jobs
+// LIFO and steals from the front of the others when it runs dry. Pinned jobs
+// sit in a separate per-worker queue that only that worker runs; nobody
+// steals them and wait() on another thread does not help with them.
+struct ThreadPool {
+    struct Queue {
+        std::mutex m;
+        std::deque<std::function<void()>> jobs;
+        std::deque<std::function<void()>> pinned;
+        std::atomic<std::size_t> pinnedCount{0};
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> roundRobin{0};
+    std::atomic<bool> stop{false};
+
+    explicit ThreadPool(std::size_t n = std::thread::hardware_concurrency()) {
+        n = n ? n : 1;
+        for (std::size_t i = 0; i < n; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            threads.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(sleepMutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    auto size() const -> std::size_t { return queues.size(); }
+
+    // NUMA node a worker runs on; always 0 without EC_NUMA or on one node
+    auto nodeOf(std::size_t worker) const -> std::size_t {
+#if defined(EC_NUMA)
+        if (numa_available() >= 0) {
+            return worker % static_cast<std::size_t>(numa_max_node() + 1);
+        }
+#endif
+        (void)worker;
+        return 0;
+    }
+
+    // Queue a job on a specific worker
+    auto submitTo(std::size_t worker, std::function<void()> job) -> void {
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard lock(queues[worker]->m);
+            queues[worker]->jobs.push_back(std::move(job));
+        }
+        {
+            // Pairs with the predicate check in run() so no wakeup is lost
+            std::lock_guard lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Queue a job that only `worker` will run
+    auto submitPinned(std::size_t worker, std::function<void()> job) -> void {
+        {
+            std::lock_guard lock(queues[worker]->m);
+            queues[worker]->pinned.push_back(std::move(job));
+            queues[worker]->pinnedCount.fetch_add(1, std::memory_order_release);
+        }
+        {
+            std::lock_guard lock(sleepMutex);
+        }
+        // Only one thread may take it, so make sure that one wakes up
+        wake.notify_all();
+    }
+
+    // Queue a job; workers keep their own spawns local, others round-robin
+    auto submit(std::function<void()> job) -> void {
+        const auto worker = currentWorker < size() ? currentWorker
+                          : roundRobin.fetch_add(1, std::memory_order_relaxed) % size();
+        submitTo(worker, std::move(job));
+    }
+
+    // Queue a job that signals counter when it finishes
+    auto submit(JobCounter &counter, std::function<void()> job) -> void {
+        counter.add();
+        submit([&counter, job = std::move(job)] {
+            job();
+            counter.done();
+        });
+    }
+
+    // Run one of worker `self`'s pinned jobs
+    auto tryRunPinned(std::size_t self) -> bool {
+        std::function<void()> job;
+        {
+            std::lock_guard lock(queues[self]->m);
+            auto &pinned = queues[self]->pinned;
+            if (pinned.empty()) {
+                return false;
+            }
+            job = std::move(pinned.front());
+            pinned.pop_front();
+            queues[self]->pinnedCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        job();
+        return true;
+    }
+
+    // Run one job from queue `self` or, failing that, steal one
+    auto tryRunOne(std::size_t self) -> bool {
+        std::function<void()> job;
+        const auto n = size();
+        for (std::size_t k = 0; k < n && !job; ++k) {
+            const auto q = (self + k) % n;
+            std::lock_guard lock(queues[q]->m);
+            auto &jobs = queues[q]->jobs;
+            if (jobs.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                job = std::move(jobs.back());
+                jobs.pop_back();
+            } else {
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+        }
+
+        if (!job) {
+            return false;
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        job();
+        return true;
+    }
+
+    // Block until counter finishes, helping with queued jobs meanwhile.
+    // A worker also runs its own pinned jobs; other threads never do.
+    auto wait(const JobCounter &counter) -> void {
+        const auto worker = currentWorker < size();
+        const auto self = worker ? currentWorker : 0;
+        while (!counter.finished()) {
+            if (!(worker && tryRunPinned(self)) && !tryRunOne(self)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    auto run(std::size_t self) -> void {
+        currentWorker = self;
+#if defined(EC_NUMA)
+        if (numa_available() >= 0) {
+            numa_run_on_node(static_cast<int>(nodeOf(self)));
+        }
+#endif
+        auto &pinned = queues[self]->pinnedCount;
+        while (true) {
+            if (tryRunPinned(self) || tryRunOne(self)) {
+                continue;
+            }
+
+            std::unique_lock lock(sleepMutex);
+            wake.wait(lock, [&] {
+                return stop || queued.load(std::memory_order_acquire) > 0 || pinned.load(std::memory_order_acquire) > 0;
+            });
+            if (stop && queued.load(std::memory_order_acquire) == 0 && pinned.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+        }
+    }
+};
+
+inline auto world_of(World &w) -> World& { return w; }
+inline auto world_of(World *w) -> World& { return *w; }
+inline auto world_of(const std::unique_ptr<World> &w) -> World& { return *w; }
+
+// Step many independent worlds in parallel, one job per batch of worlds.
+// Small worlds are grouped until a batch covers minBatch entity slots so
+// thousands of tiny rooms don't drown the pool in scheduling overhead.
+template<typename Worlds, typename Step>
+inline auto step_worlds(ThreadPool &pool, Worlds &worlds, Step step, std::size_t minBatch = 4096) -> void {
+    JobCounter counter;
+    auto it  = std::begin(worlds);
+    auto end = std::end(worlds);
+
+    while (it != end) {
+        auto first = it;
+        std::size_t cost = 0;
+        while (it != end && cost < minBatch) {
+            cost += world_of(*it).nextEntity + 1;
+            ++it;
+        }
+
+        pool.submit(counter, [first, last = it, &step] {
+            for (auto w = first; w != last; ++w) {
+                step(world_of(*w));
+            }
+        });
+    }
+
+    pool.wait(counter);
+}
+
+// Entities per parallel chunk. Chunk c is pinned to worker c % pool.size(),
+// so the same thread (and NUMA node) touches the same slice every tick.
+inline constexpr std::size_t ParallelChunk = 4096;
+
+// Parallel query over fixed entity chunks with stable worker affinity
+template<typename... Ts, typename Func>
+inline auto par_query(World &w, ThreadPool &pool, Func f, std::size_t chunk = ParallelChunk) -> void {
+    ParallelScope parallel(w);
+    JobCounter counter;
+    const auto chunks = (static_cast<std::size_t>(w.nextEntity) + chunk - 1) / chunk;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        const auto begin = static_cast<Entity>(c * chunk);
+        const auto end   = static_cast<Entity>(std::min<std::size_t>(w.nextEntity, (c + 1) * chunk));
+        counter.add();
+        pool.submitPinned(c % pool.size(), [&w, &f, &counter, begin, end, access = currentAccess] {
+            // Workers inherit the calling system's access declaration
+            ScopedAccess scope(access);
+            query_range<Ts...>(w, begin, end, f);
+            counter.done();
+        });
+    }
+
+    pool.wait(counter);
+}
+
+// Deterministic parallel query for lockstep simulations. Chunk boundaries
+// depend only on entity IDs and the chunk size, each chunk records structural
+// changes into its own CommandBuffer, and the buffers are applied in chunk
+// order after all chunks finish, so the result is identical for any thread
+// count. f(Entity, CommandBuffer&, Ts*...) may write the current entity's
+// components but must not read other entities' components that any chunk
+// writes. buffers is reused across calls to avoid reallocating.
+template<typename... Ts, typename Func>
+inline auto par_query_deterministic(World &w, ThreadPool &pool, std::vector<CommandBuffer> &buffers,
+                                    Func f, std::size_t chunk = ParallelChunk) -> void {
+    const auto chunks = (static_cast<std::size_t>(w.nextEntity) + chunk - 1) / chunk;
+    if (buffers.size() < chunks) {
+        buffers.resize(chunks);
+    }
+
+    ParallelScope parallel(w);
+    JobCounter counter;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        const auto begin = static_cast<Entity>(c * chunk);
+        const auto end   = static_cast<Entity>(std::min<std::size_t>(w.nextEntity, (c + 1) * chunk));
+        counter.add();
+        pool.submitPinned(c % pool.size(), [&w, &f, &counter, &cb = buffers[c], begin, end, access = currentAccess] {
+            ScopedAccess scope(access);
+            query_range<Ts...>(w, begin, end, [&](Entity e, Ts*... cs) { f(e, cb, cs...); });
+            counter.done();
+        });
+    }
+    pool.wait(counter);
+    parallel.end();
+
+    // Layout switches caused by the buffers wait until all are applied
+    for (std::size_t c = 0; c < chunks; ++c) {
+        apply(w, buffers[c]);
+    }
+}
+
+// Deterministic parallel reduction: map(Entity, Ts*...) -> R is folded with
+// combine(R, R) -> R left to right inside each fixed chunk, then the chunk
+// partials are folded in chunk order. init is applied once, so it need not be
+// an identity. Floating-point results are bit-identical for any thread count.
+template<typename... Ts, typename R, typename Map, typename Combine>
+inline auto par_reduce_deterministic(World &w, ThreadPool &pool, R init, Map map, Combine combine,
+                                     std::size_t chunk = ParallelChunk) -> R {
+    const auto chunks = (static_cast<std::size_t>(w.nextEntity) + chunk - 1) / chunk;
+    // Chunks without matches stay empty instead of contributing a copy of init
+    std::vector<std::optional<R>> partials(chunks);
+
+    ParallelScope parallel(w);
+    JobCounter counter;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        const auto begin = static_cast<Entity>(c * chunk);
+        const auto end   = static_cast<Entity>(std::min<std::size_t>(w.nextEntity, (c + 1) * chunk));
+        counter.add();
+        pool.submitPinned(c % pool.size(), [&w, &map, &combine, &counter, &acc = partials[c], begin, end, access = currentAccess] {
+            ScopedAccess scope(access);
+            query_range<Ts...>(w, begin, end, [&](Entity e, Ts*... cs) {
+                acc = acc ? combine(*acc, map(e, cs...)) : R(map(e, cs...));
+            });
+            counter.done();
+        });
+    }
+    pool.wait(counter);
+
+    auto result = init;
+    for (auto &partial : partials) {
+        if (partial) {
+            result = combine(result, *partial);
+        }
+    }
+    return result;
+}
+
+// Atomic view of one field of a component, for parallel systems writing into
+// other entities' components (damage, forces) without locking the world.
+template<typename C, typename V>
+inline auto atomic_field(C *comp, V C::*field) -> std::atomic_ref<V> {
+    return std::atomic_ref<V>(comp->*field);
+}
+
+// Atomically add delta to a field of e's component; false if e lacks it
+template<typename C, typename V>
+inline auto atomic_add(World &w, Entity e, V C::*field, V delta) -> bool {
+    auto *comp = get_component<C>(w, e);
+    if (!comp) {
+        return false;
+    }
+
+    atomic_field(comp, field).fetch_add(delta, std::memory_order_relaxed);
+    return true;
+}
+
+// Atomically replace a field with op(old) via compare-exchange (e.g. min/max)
+template<typename C, typename V, typename Op>
+inline auto atomic_update(World &w, Entity e, V C::*field, Op op) -> bool {
+    auto *comp = get_component<C>(w, e);
+    if (!comp) {
+        return false;
+    }
+
+    auto ref = atomic_field(comp, field);
+    auto old = ref.load(std::memory_order_relaxed);
+    while (!ref.compare_exchange_weak(old, op(old), std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+// Deferred accumulation into one component field. Each pool worker appends
+// deltas to its own cache-line aligned lane, so parallel systems never
+// contend; apply() merges the lanes in order at a sync point. Threads outside
+// the pool share the last lane, so only one of them may add at a time.
+template<typename C, typename V>
+struct Accumulator {
+    struct alignas(64) Lane {
+        std::vector<std::pair<Entity, V>> deltas;
+    };
+
+    V C::*field;
+    std::vector<Lane> lanes;
+
+    Accumulator(V C::*f, std::size_t workers) : field(f), lanes(workers + 1) {}
+    Accumulator(V C::*f, const ThreadPool &pool) : Accumulator(f, pool.size()) {}
+
+    auto add(Entity e, V delta) -> void {
+        const auto lane = currentWorker < lanes.size() - 1 ? currentWorker : lanes.size() - 1;
+        lanes[lane].deltas.emplace_back(e, delta);
+    }
+
+    // Fold all deltas into the world; lanes keep their capacity
+    auto apply(World &w) -> void {
+        for (auto &lane : lanes) {
+            for (auto &[e, delta] : lane.deltas) {
+                if (auto *comp = get_component<C>(w, e)) {
+                    comp->*field += delta;
+                }
+            }
+            lane.deltas.clear();
+        }
+    }
+};
+
+// Move each chunk's pages (alive flags, masks and component data) to the
+// NUMA node of the worker par_query assigns that chunk to. Call once pools
+// have reached their steady-state size. Only pages lying entirely inside an
+// array are moved, so heap neighbours stay put; runs of chunks on the same
+// node are bound with one call. Status::ERROR if the kernel refused a move.
+// No-op without EC_NUMA (link -lnuma) or on single-node machines.
+inline auto numa_place(World &w, ThreadPool &pool, std::size_t chunk = ParallelChunk) -> Status {
+#if defined(EC_NUMA)
+    if (numa_available() < 0 || numa_max_node() == 0) {
+        return Status::OK;
+    }
+
+    const auto page = static_cast<std::uintptr_t>(numa_pagesize());
+    auto up   = [&](std::uintptr_t a) { return (a + page - 1) / page * page; };
+    auto down = [&](std::uintptr_t a) { return a / page * page; };
+
+    auto *nodes = numa_allocate_nodemask();
+    bool ok = true;
+    auto bind = [&](std::uintptr_t first, std::uintptr_t last, std::size_t node) {
+        if (last <= first) {
+            return;
+        }
+        numa_bitmask_clearall(nodes);
+        numa_bitmask_setbit(nodes, static_cast<unsigned>(node));
+        if (mbind(reinterpret_cast<void*>(first), last - first, MPOL_PREFERRED,
+                  nodes->maskp, nodes->size + 1, MPOL_MF_MOVE) != 0) {
+            ok = false;
+        }
+    };
+
+    auto place = [&](void *base, std::size_t elemSize, std::size_t count) {
+        const auto addr   = reinterpret_cast<std::uintptr_t>(base);
+        const auto end    = down(addr + count * elemSize);
+        const auto chunks = (count + chunk - 1) / chunk;
+
+        // A page belongs to the chunk holding its first byte
+        std::uintptr_t runStart = 0;
+        std::size_t runNode = 0;
+        for (std::size_t c = 0; c < chunks; ++c) {
+            const auto first = std::min(up(addr + c * chunk * elemSize), end);
+            const auto node  = pool.nodeOf(c % pool.size());
+            if (c == 0) {
+                runStart = first;
+                runNode  = node;
+            } else if (node != runNode) {
+                bind(runStart, first, runNode);
+                runStart = first;
+                runNode  = node;
+            }
+        }
+        if (chunks > 0) {
+            bind(runStart, end, runNode);
+        }
+    };
+
+    place(w.alive.data(), 1, w.alive.size());
+    for (auto &p : w.pools) {
+        if (p) {
+            place(p->mask.data(), 1, p->mask.size());
+            if (p->contiguous()) {
+                place(p->rawData(), p->elemSize, p->mask.size());
+            }
+        }
+    }
+
+    numa_bitmask_free(nodes);
+    return ok ? Status::OK : Status::ERROR;
+#else
+    (void)w;
+    (void)pool;
+    (void)chunk;
+    return Status::OK;
+#endif
+}
+
+// Bounded lock-free single-producer/single-consumer queue. Capacity is
+// rounded up to a power of two. Head and tail live on separate cache lines,
+// and each side caches the other's index so a batch touches shared state once.
+template<typename T>
+struct SpscChannel {
+    struct alignas(64) Index {
+        std::atomic<std::size_t> pos{0};
+        std::size_t cached = 0;
+    };
+
+    std::vector<T> slots;
+    std::size_t wrap;
+    Index head;  // consumer
+    Index tail;  // producer
+
+    explicit SpscChannel(std::size_t capacity)
+        : slots(std::bit_ceil(std::max<std::size_t>(capacity, 2))), wrap(slots.size() - 1) {}
+
+    // Push as many of in as fit; returns the number pushed
+    auto push(std::span<const T> in) -> std::size_t {
+        const auto t = tail.pos.load(std::memory_order_relaxed);
+        if (slots.size() - (t - tail.cached) < in.size()) {
+            tail.cached = head.pos.load(std::memory_order_acquire);
+        }
+        const auto n = std::min(in.size(), slots.size() - (t - tail.cached));
+        for (std::size_t i = 0; i < n; ++i) {
+            slots[(t + i) & wrap] = in[i];
+        }
+        tail.pos.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    auto push(const T &msg) -> bool { return push(std::span<const T>(&msg, 1)) == 1; }
+
+    // Pop up to out.size() messages in order; returns the number popped
+    auto pop(std::span<T> out) -> std::size_t {
+        const auto h = head.pos.load(std::memory_order_relaxed);
+        if (head.cached - h < out.size()) {
+            head.cached = tail.pos.load(std::memory_order_acquire);
+        }
+        const auto n = std::min(out.size(), head.cached - h);
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = std::move(slots[(h + i) & wrap]);
+        }
+        head.pos.store(h + n, std::memory_order_release);
+        return n;
+    }
+};
+
+// Bounded lock-free multi-producer/single-consumer queue. Every slot carries a
+// sequence number telling whose turn it is, so producers only contend on the
+// tail CAS and the consumer never touches it.
+template<typename T>
+struct MpscChannel {
+    struct Slot {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t capacity;
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::size_t head = 0;
+
+    explicit MpscChannel(std::size_t cap)
+        : slots(new Slot[std::bit_ceil(std::max<std::size_t>(cap, 2))]),
+          capacity(std::bit_ceil(std::max<std::size_t>(cap, 2))) {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    auto slot(std::size_t pos) -> Slot& { return slots[pos & (capacity - 1)]; }
+
+    // Push as many of in as fit, claiming runs of slots with one CAS. The
+    // consumer frees slots in order, so if the last slot of a run is free all
+    // earlier ones are too. Returns the number pushed.
+    auto push(std::span<const T> in) -> std::size_t {
+        std::size_t pushed = 0;
+        auto pos = tail.load(std::memory_order_relaxed);
+        while (pushed < in.size()) {
+            auto n = std::min(in.size() - pushed, capacity);
+            while (n > 0 && slot(pos + n - 1).seq.load(std::memory_order_acquire) != pos + n - 1) {
+                n /= 2;
+            }
+            if (n == 0) {
+                // Full, unless another producer moved tail meanwhile
+                const auto now = tail.load(std::memory_order_relaxed);
+                if (now == pos) {
+                    break;
+                }
+                pos = now;
+                continue;
+            }
+            if (!tail.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                continue;
+            }
+            for (std::size_t i = 0; i < n; ++i) {
+                auto &s = slot(pos + i);
+                s.value = in[pushed + i];
+                s.seq.store(pos + i + 1, std::memory_order_release);
+            }
+            pushed += n;
+            pos += n;
+        }
+        return pushed;
+    }
+
+    auto push(const T &msg) -> bool { return push(std::span<const T>(&msg, 1)) == 1; }
+
+    // Pop up to out.size() published messages; consumer thread only
+    auto pop(std::span<T> out) -> std::size_t {
+        std::size_t n = 0;
+        while (n < out.size()) {
+            auto &s = slot(head);
+            if (s.seq.load(std::memory_order_acquire) != head + 1) {
+                break;
+            }
+            out[n++] = std::move(s.value);
+            s.seq.store(head + capacity, std::memory_order_release);
+            ++head;
+        }
+        return n;
+    }
+};
+
+// Drain a channel into the world in one batch: messages are popped through
+// scratch, f(CommandBuffer&, const T&) turns each into deferred commands, and
+// the buffer is applied once. Call from the world's owning thread, e.g. at the
+// start of a shard's tick. Returns the number of messages handled.
+template<typename Channel, typename T, typename Func>
+inline auto receive(World &w, Channel &ch, std::span<T> scratch, CommandBuffer &cb, Func f) -> std::size_t {
+    std::size_t total = 0;
+    while (const auto n = ch.pop(scratch)) {
+        for (std::size_t i = 0; i < n; ++i) {
+            f(cb, std::as_const(scratch[i]));
+        }
+        total += n;
+    }
+    apply(w, cb);
+    return total;
+}
+
+// Packed LSB-first validity bitmap in Arrow layout: bit e is set when entity
+// e is alive and, if pool is given, has the component. Returns the null count.
+inline auto pack_validity(const World &w, const PoolBase *pool, std::vector<std::uint8_t> &bits) -> std::size_t {
+    const auto rows = static_cast<std::size_t>(w.nextEntity);
+    bits.assign((rows + 7) / 8, 0);
+
+    std::size_t valid = 0;
+    for (std::size_t e = 0; e < rows; ++e) {
+        const bool set = w.alive[e] && (!pool || pool->mask[e]);
+        bits[e / 8] |= static_cast<std::uint8_t>(set) << (e % 8);
+        valid += set;
+    }
+
+    return rows - valid;
+}
+
+// Buffers and strings kept alive for the consumer until release()
+struct ArrowExport {
+    std::vector<std::uint8_t> validity;
+    std::vector<std::byte> packed;
+    std::array<const void*, 2> buffers{};
+    std::string format;
+    std::string name;
+
+    std::vector<ArrowArray> childArrays;
+    std::vector<ArrowSchema> childSchemas;
+    std::vector<ArrowArray*> childArrayPtrs;
+    std::vector<ArrowSchema*> childSchemaPtrs;
+};
+
+inline auto release_arrow_array(ArrowArray *array) -> void {
+    for (std::int64_t i = 0; i < array->n_children; ++i) {
+        if (array->children[i]->release) {
+            array->children[i]->release(array->children[i]);
+        }
+    }
+    delete static_cast<ArrowExport*>(array->private_data);
+    array->release = nullptr;
+}
+
+inline auto release_arrow_schema(ArrowSchema *schema) -> void {
+    for (std::int64_t i = 0; i < schema->n_children; ++i) {
+        if (schema->children[i]->release) {
+            schema->children[i]->release(schema->children[i]);
+        }
+    }
+    delete static_cast<ArrowExport*>(schema->private_data);
+    schema->release = nullptr;
+}
+
+// Export one pool as an Arrow fixed-size-binary column ("w:<size>") of
+// nextEntity rows. For contiguous pools the data buffer points straight into
+// the pool (zero-copy, valid until the pool grows); sparse pools are copied
+// into a dense buffer owned by the export, leaving their layout alone. The
+// validity bitmap is a packed copy of alive && mask.
+inline auto export_column(World &w, std::size_t tid, ArrowArray *array, ArrowSchema *schema) -> Status {
+    if (tid >= w.pools.size() || !w.pools[tid]) {
+        return Status::ERROR;
+    }
+    auto &pool = *w.pools[tid];
+
+    auto *arrayData = new ArrowExport();
+    const auto nulls = pack_validity(w, &pool, arrayData->validity);
+    const void *data = nullptr;
+    if (pool.contiguous()) {
+        data = pool.rawData();
+    } else {
+        arrayData->packed.resize(static_cast<std::size_t>(w.nextEntity) * pool.elemSize);
+        for (std::size_t e = 0; e < w.nextEntity; ++e) {
+            if (pool.mask[e]) {
+                std::memcpy(arrayData->packed.data() + e * pool.elemSize, pool.rawAt(e), pool.elemSize);
+            }
+        }
+        data = arrayData->packed.data();
+    }
+    arrayData->buffers = {arrayData->validity.data(), data};
+    *array = ArrowArray{
+        static_cast<std::int64_t>(w.nextEntity), static_cast<std::int64_t>(nulls), 0,
+        2, 0, arrayData->buffers.data(), nullptr, nullptr, release_arrow_array, arrayData
+    };
+
+    auto *schemaData = new ArrowExport();
+    schemaData->format = "w:" + std::to_string(pool.elemSize);
+    schemaData->name   = pool.name;
+    *schema = ArrowSchema{
+        schemaData->format.c_str(), schemaData->name.c_str(), nullptr, ARROW_FLAG_NULLABLE,
+        0, nullptr, nullptr, release_arrow_schema, schemaData
+    };
+
+    return Status::OK;
+}
+
+// Export every pool as one Arrow struct array ("+s"), one child column per
+// component type, with entity liveness as the top-level validity.
+inline auto export_world(World &w, ArrowArray *array, ArrowSchema *schema) -> Status {
+    auto *arrayData  = new ArrowExport();
+    auto *schemaData = new ArrowExport();
+
+    std::vector<std::size_t> tids;
+    for (std::size_t tid = 0; tid < w.pools.size(); ++tid) {
+        if (w.pools[tid]) {
+            tids.push_back(tid);
+        }
+    }
+
+    arrayData->childArrays.resize(tids.size());
+    schemaData->childSchemas.resize(tids.size());
+    for (std::size_t i = 0; i < tids.size(); ++i) {
+        export_column(w, tids[i], &arrayData->childArrays[i], &schemaData->childSchemas[i]);
+        arrayData->childArrayPtrs.push_back(&arrayData->childArrays[i]);
+        schemaData->childSchemaPtrs.push_back(&schemaData->childSchemas[i]);
+    }
+
+    const auto nulls = pack_validity(w, nullptr, arrayData->validity);
+    arrayData->buffers = {arrayData->validity.data(), nullptr};
+    *array = ArrowArray{
+        static_cast<std::int64_t>(w.nextEntity), static_cast<std::int64_t>(nulls), 0,
+        1, static_cast<std::int64_t>(tids.size()), arrayData->buffers.data(),
+        arrayData->childArrayPtrs.data(), nullptr, release_arrow_array, arrayData
+    };
+
+    schemaData->format = "+s";
+    schemaData->name   = "world";
+    *schema = ArrowSchema{
+        schemaData->format.c_str(), schemaData->name.c_str(), nullptr, 0,
+        static_cast<std::int64_t>(tids.size()), schemaData->childSchemaPtrs.data(),
+        nullptr, release_arrow_schema, schemaData
+    };
+
+    return Status::OK;
+}
+
+// Column file layout (little-endian), every buffer starting on a 64-byte
+// boundary as in Arrow IPC bodies:
+//   char[8] magic "ECCOLS01", u64 rows, u64 columns
+//   per column: u32 nameLength, name, u64 elemSize, u64 validityOffset, u64 dataOffset
+//   buffers: (rows + 7) / 8 validity bytes and rows * elemSize data bytes per column
+// Column 0 is "ec.entity" holding u32 entity IDs, valid where alive.
+inline constexpr char ColumnFileMagic[8] = {'E', 'C', 'C', 'O', 'L', 'S', '0', '1'};
+inline constexpr std::size_t ColumnAlign = 64;
+inline constexpr std::string_view EntityColumn = "ec.entity";
+
+// Write every pool of the world as columns. Component data is written
+// straight from pool memory, one write per pool.
+inline auto write_columns(World &w, const std::string &path) -> Status {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return Status::ERROR;
+    }
+
+    struct Column {
+        std::string_view name;
+        std::size_t elemSize;
+        const void *data;
+        PoolBase *pool;
+    };
+
+    const auto rows = static_cast<std::uint64_t>(w.nextEntity);
+    std::vector<Entity> ids(rows);
+    for (std::size_t e = 0; e < rows; ++e) {
+        ids[e] = static_cast<Entity>(e);
+    }
+
+    std::vector<Column> columns = {{EntityColumn, sizeof(Entity), ids.data(), nullptr}};
+    for (auto &p : w.pools) {
+        if (p) {
+            // Sparse pools are written per entity below and keep their layout
+            columns.push_back({p->name, p->elemSize, p->contiguous() ? p->rawData() : nullptr, p.get()});
+        }
+    }
+
+    auto align = [](std::uint64_t n) { return (n + ColumnAlign - 1) / ColumnAlign * ColumnAlign; };
+
+    // Lay out buffers after the header
+    std::uint64_t header = sizeof(ColumnFileMagic) + 2 * sizeof(std::uint64_t);
+    for (auto &c : columns) {
+        header += sizeof(std::uint32_t) + c.name.size() + 3 * sizeof(std::uint64_t);
+    }
+
+    std::vector<std::uint64_t> offsets;
+    auto cursor = align(header);
+    for (auto &c : columns) {
+        offsets.push_back(cursor);
+        cursor = align(cursor + (rows + 7) / 8);
+        offsets.push_back(cursor);
+        cursor = align(cursor + rows * c.elemSize);
+    }
+
+    auto put = [&](const void *p, std::size_t n) { out.write(static_cast<const char*>(p), static_cast<std::streamsize>(n)); };
+    auto putU64 = [&](std::uint64_t v) { put(&v, sizeof(v)); };
+
+    put(ColumnFileMagic, sizeof(ColumnFileMagic));
+    putU64(rows);
+    putU64(columns.size());
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        const auto len = static_cast<std::uint32_t>(columns[i].name.size());
+        put(&len, sizeof(len));
+        put(columns[i].name.data(), len);
+        putU64(columns[i].elemSize);
+        putU64(offsets[2 * i]);
+        putU64(offsets[2 * i + 1]);
+    }
+
+    std::uint64_t written = header;
+    static constexpr char zeros[ColumnAlign] = {};
+    auto padTo = [&](std::uint64_t offset) {
+        put(zeros, offset - written);
+        written = offset;
+    };
+
+    std::vector<std::uint8_t> bits;
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        pack_validity(w, columns[i].pool, bits);
+        padTo(offsets[2 * i]);
+        put(bits.data(), bits.size());
+        written += bits.size();
+
+        padTo(offsets[2 * i + 1]);
+        if (!columns[i].pool || columns[i].pool->contiguous()) {
+            put(columns[i].data, rows * columns[i].elemSize);
+        } else {
+            auto *pool = columns[i].pool;
+            const std::vector<char> blank(pool->elemSize, 0);
+            for (std::size_t e = 0; e < rows; ++e) {
+                put(pool->mask[e] ? pool->rawAt(e) : blank.data(), pool->elemSize);
+            }
+        }
+        written += rows * columns[i].elemSize;
+    }
+    padTo(align(written));
+
+    return out ? Status::OK : Status::ERROR;
+}
+
+// Load a column file (see write_columns) into a world in large blocks.
+// Entity IDs from the file are kept, so this is meant for bootstrapping an
+// empty world. Columns are matched to registered components by name
+// (register_component) and loaded bytewise; columns of unknown components are
+// skipped. With a pool, each column loads as its own job on its own stream.
+// Entity IDs must lie in [0, rows), and every column must fit in the file;
+// anything else is rejected before the world grows.
+inline auto load_columns(World &w, const std::string &path, ThreadPool *pool = nullptr) -> Status {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return Status::ERROR;
+    }
+    const auto fileSize = static_cast<std::uint64_t>(in.tellg());
+    in.seekg(0);
+
+    // Whether n items of size bytes starting at offset lie inside the file
+    auto fits = [&](std::uint64_t offset, std::uint64_t n, std::uint64_t size) {
+        return offset <= fileSize && (size == 0 || n <= (fileSize - offset) / size);
+    };
+
+    struct Column {
+        std::string name;
+        std::uint64_t elemSize;
+        std::uint64_t validityOffset;
+        std::uint64_t dataOffset;
+    };
+
+    auto get = [](std::ifstream &s, void *p, std::size_t n) {
+        s.read(static_cast<char*>(p), static_cast<std::streamsize>(n));
+        return static_cast<bool>(s);
+    };
+
+    char magic[sizeof(ColumnFileMagic)];
+    std::uint64_t rows = 0;
+    std::uint64_t count = 0;
+    if (!get(in, magic, sizeof(magic)) || std::memcmp(magic, ColumnFileMagic, sizeof(magic)) != 0 ||
+        !get(in, &rows, sizeof(rows)) || !get(in, &count, sizeof(count)) || count == 0 ||
+        !fits(0, count, sizeof(std::uint32_t) + 3 * sizeof(std::uint64_t))) {
+        return Status::ERROR;
+    }
+
+    std::vector<Column> columns(count);
+    for (auto &c : columns) {
+        std::uint32_t len = 0;
+        if (!get(in, &len, sizeof(len)) || !fits(static_cast<std::uint64_t>(in.tellg()), len, 1)) {
+            return Status::ERROR;
+        }
+        c.name.resize(len);
+        if (!get(in, c.name.data(), len) || !get(in, &c.elemSize, sizeof(c.elemSize)) ||
+            !get(in, &c.validityOffset, sizeof(c.validityOffset)) || !get(in, &c.dataOffset, sizeof(c.dataOffset))) {
+            return Status::ERROR;
+        }
+    }
+    if (columns[0].name != EntityColumn || columns[0].elemSize != sizeof(Entity)) {
+        return Status::ERROR;
+    }
+    const auto bitBytes = static_cast<std::size_t>((rows + 7) / 8);
+    for (auto &c : columns) {
+        if (!fits(c.validityOffset, bitBytes, 1) || !fits(c.dataOffset, rows, c.elemSize)) {
+            return Status::ERROR;
+        }
+    }
+
+    // Entity column decides which rows exist and where they go
+    std::vector<std::uint8_t> live(bitBytes);
+    std::vector<Entity> ids(rows);
+    in.seekg(static_cast<std::streamoff>(columns[0].validityOffset));
+    if (!get(in, live.data(), bitBytes)) {
+        return Status::ERROR;
+    }
+    in.seekg(static_cast<std::streamoff>(columns[0].dataOffset));
+    if (!get(in, ids.data(), rows * sizeof(Entity))) {
+        return Status::ERROR;
+    }
+
+    bool identity = true;
+    Entity maxId = 0;
+    for (std::size_t r = 0; r < rows; ++r) {
+        if (ids[r] >= rows) {
+            return Status::ERROR;
+        }
+        identity = identity && ids[r] == r;
+        maxId = std::max(maxId, ids[r]);
+    }
+
+    if (rows > 0) {
+        if (!w.ensureEntity(maxId)) {
+            return Status::ERROR;
+        }
+        w.nextEntity = std::max<Entity>(w.nextEntity, maxId + 1);
+    }
+    for (std::size_t r = 0; r < rows; ++r) {
+        if (live[r / 8] >> (r % 8) & 1) {
+            w.alive[ids[r]] = 1;
+        }
+    }
+
+    // Resolve pools up front so jobs never touch the type map
+    std::vector<std::pair<const Column*, PoolBase*>> jobs;
+    for (std::size_t i = 1; i < columns.size(); ++i) {
+        const auto tid = find_component(w, columns[i].name);
+        if (tid == NullType) {
+            continue;
+        }
+        if (w.pools[tid]->elemSize != columns[i].elemSize) {
+            return Status::ERROR;
+        }
+        jobs.emplace_back(&columns[i], w.pools[tid].get());
+    }
+
+    std::atomic<bool> failed{false};
+    auto loadColumn = [&](const Column &c, PoolBase &p) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<std::uint8_t> bits(bitBytes);
+        file.seekg(static_cast<std::streamoff>(c.validityOffset));
+        if (!get(file, bits.data(), bitBytes)) {
+            failed = true;
+            return;
+        }
+
+        for (std::size_t r = 0; r < rows; ++r) {
+            if (live[r / 8] >> (r % 8) & 1) {
+                p.mask[ids[r]] = bits[r / 8] >> (r % 8) & 1;
+            }
+        }
+
+        // Zero-size components are mask-only
+        if (c.elemSize == 0) {
+            return;
+        }
+
+        file.seekg(static_cast<std::streamoff>(c.dataOffset));
+        auto *base = static_cast<std::byte*>(p.rawData());
+        if (identity) {
+            // Straight into pool memory in one read
+            if (!get(file, base, rows * c.elemSize)) {
+                failed = true;
+            }
+            return;
+        }
+
+        // Scattered IDs: stream through a bounded staging buffer
+        constexpr std::size_t BlockBytes = 1 << 20;
+        const auto blockRows = std::max<std::size_t>(1, BlockBytes / c.elemSize);
+        std::vector<std::byte> block(blockRows * c.elemSize);
+        for (std::size_t r = 0; r < rows; r += blockRows) {
+            const auto n = std::min<std::size_t>(blockRows, rows - r);
+            if (!get(file, block.data(), n * c.elemSize)) {
+                failed = true;
+                return;
+            }
+            for (std::size_t k = 0; k < n; ++k) {
+                if (live[(r + k) / 8] >> ((r + k) % 8) & 1) {
+                    std::memcpy(base + ids[r + k] * c.elemSize, block.data() + k * c.elemSize, c.elemSize);
+                }
+            }
+        }
+    };
+
+    if (pool) {
+        JobCounter counter;
+        for (auto &[column, target] : jobs) {
+            pool->submit(counter, [&, column, target] { loadColumn(*column, *target); });
+        }
+        pool->wait(counter);
+    } else {
+        for (auto &[column, target] : jobs) {
+            loadColumn(*column, *target);
+        }
+    }
+
+    for (auto &[column, target] : jobs) {
+        target->refresh();
+    }
+
+    return failed ? Status::ERROR : Status::OK;
+}
+
+inline auto save_trace(const TraceRecorder &rec, const std::string &path) -> Status {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(TraceFileMagic, sizeof(TraceFileMagic));
+    out.write(reinterpret_cast<const char*>(rec.bytes.data()), static_cast<std::streamsize>(rec.bytes.size()));
+    return out ? Status::OK : Status::ERROR;
+}
+
+inline auto load_trace(const std::string &path, std::vector<std::uint8_t> &bytes) -> Status {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(TraceFileMagic)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, TraceFileMagic, sizeof(magic)) != 0) {
+        return Status::ERROR;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return Status::OK;
+}
+
+// Latency of one kind of operation, in nanoseconds
+struct OpStats {
+    std::uint64_t count = 0;
+    std::uint64_t total = 0;
+    std::uint64_t min   = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max   = 0;
+
+    auto add(std::uint64_t ns) -> void {
+        ++count;
+        total += ns;
+        min = std::min(min, ns);
+        max = std::max(max, ns);
+    }
+
+    auto mean() const -> double { return count ? static_cast<double>(total) / static_cast<double>(count) : 0.0; }
+};
+
+// Per-operation latency as recorded in the trace and as measured on replay,
+// indexed by TraceOp
+struct ReplayReport {
+    std::array<OpStats, TraceOpCount> recorded;
+    std::array<OpStats, TraceOpCount> replayed;
+};
+
+// Replay a trace against a fresh World. Component types are recreated as
+// runtime types of the recorded size and alignment, so they get the same pool
+// layout; component contents are not recorded and replay as zeros.
+inline auto replay_trace(std::span<const std::uint8_t> trace, ReplayReport &report) -> Status {
+    using Clock = std::chrono::steady_clock;
+
+    World w;
+    std::vector<std::size_t> typeIds;
+    std::vector<std::byte> scratch;
+    std::vector<std::size_t> queryIds;
+    volatile std::uintptr_t sink = 0;
+
+    std::size_t pos = 0;
+    while (pos < trace.size()) {
+        const auto op = static_cast<TraceOp>(trace[pos++]);
+        std::uint64_t a = 0;
+        std::uint64_t b = 0;
+
+        if (op == TraceOp::DefineType) {
+            std::uint64_t size = 0;
+            std::uint64_t align = 0;
+            std::uint64_t len = 0;
+            if (!get_varint(trace, pos, size) || !get_varint(trace, pos, align) ||
+                !get_varint(trace, pos, len) || pos + len > trace.size()) {
+                return Status::ERROR;
+            }
+            const std::string_view name(reinterpret_cast<const char*>(trace.data() + pos), len);
+            pos += len;
+
+            ComponentInfo info;
+            info.size  = size;
+            info.align = align;
+            typeIds.push_back(register_component(w, name, info));
+            scratch.resize(std::max<std::size_t>(scratch.size(), size));
+            continue;
+        }
+
+        std::uint64_t delta = 0;
+        std::uint64_t duration = 0;
+        if (static_cast<std::size_t>(op) >= TraceOpCount ||
+            !get_varint(trace, pos, delta) || !get_varint(trace, pos, duration) || !get_varint(trace, pos, a)) {
+            return Status::ERROR;
+        }
+        report.recorded[static_cast<std::size_t>(op)].add(duration);
+
+        // Operand: entity, or type count for queries; then type indices
+        const auto entity = static_cast<Entity>(a);
+        const auto typeCount = op == TraceOp::Query ? a : (op == TraceOp::Create || op == TraceOp::Destroy ? 0 : 1);
+        queryIds.clear();
+        for (std::uint64_t i = 0; i < typeCount; ++i) {
+            if (!get_varint(trace, pos, b) || b >= typeIds.size()) {
+                return Status::ERROR;
+            }
+            queryIds.push_back(typeIds[b]);
+        }
+
+        const auto start = Clock::now();
+        switch (op) {
+        case TraceOp::Create:
+            create_entity(w);
+            break;
+        case TraceOp::Destroy:
+            destroy_entity(w, entity);
+            break;
+        case TraceOp::Add:
+            add_component(w, entity, queryIds[0], scratch.data());
+            break;
+        case TraceOp::Remove:
+            remove_component(w, entity, queryIds[0]);
+            break;
+        case TraceOp::Get:
+            sink = reinterpret_cast<std::uintptr_t>(get_component(w, entity, queryIds[0]));
+            break;
+        case TraceOp::Query:
+            query_dynamic(w, queryIds, [&](Entity e, void* const*) { sink = sink + e; });
+            break;
+        default:
+            break;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        report.replayed[static_cast<std::size_t>(op)].add(static_cast<std::uint64_t>(ns));
+    }
+
+    return Status::OK;
+}
+
+// LZ77-style byte compressor used by snapshots. The stream is a sequence of
+// [varint literal count][literals][varint match length][varint offset], where
+// a match length of 0 ends the block. Matches are found through a 4-byte
+// hash table, so long zero or repeated runs collapse to a few bytes.
+inline constexpr std::size_t LzMinMatch = 4;
+
+inline auto lz_compress(std::span<const std::uint8_t> in, std::vector<std::uint8_t> &out) -> void {
+    constexpr unsigned HashBits = 12;
+    std::array<std::uint32_t, 1u << HashBits> table;
+    table.fill(std::numeric_limits<std::uint32_t>::max());
+
+    auto load32 = [&](std::size_t i) {
+        std::uint32_t v;
+        std::memcpy(&v, in.data() + i, sizeof(v));
+        return v;
+    };
+    auto hash = [](std::uint32_t v) { return (v * 2654435761u) >> (32 - HashBits); };
+
+    out.clear();
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+    while (i + LzMinMatch <= in.size()) {
+        const auto v = load32(i);
+        const auto h = hash(v);
+        const auto cand = table[h];
+        table[h] = static_cast<std::uint32_t>(i);
+        if (cand == std::numeric_limits<std::uint32_t>::max() || load32(cand) != v) {
+            // Skip faster through incompressible stretches
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        // Extend eight bytes at a time, then finish bytewise
+        auto len = LzMinMatch;
+        while (i + len + 8 <= in.size()) {
+            std::uint64_t x, y;
+            std::memcpy(&x, in.data() + cand + len, 8);
+            std::memcpy(&y, in.data() + i + len, 8);
+            if (x != y) {
+                break;
+            }
+            len += 8;
+        }
+        while (i + len < in.size() && in[cand + len] == in[i + len]) {
+            ++len;
+        }
+
+        put_varint(out, i - anchor);
+        out.insert(out.end(), in.begin() + anchor, in.begin() + i);
+        put_varint(out, len);
+        put_varint(out, i - cand);
+        i += len;
+        anchor = i;
+    }
+
+    put_varint(out, in.size() - anchor);
+    out.insert(out.end(), in.begin() + anchor, in.end());
+    put_varint(out, 0);
+}
+
+// Decode into out, which must have exactly the original size
+inline auto lz_decompress(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) -> bool {
+    std::size_t pos = 0;
+    std::size_t o = 0;
+    for (;;) {
+        std::uint64_t literals = 0, len = 0, offset = 0;
+        if (!get_varint(in, pos, literals) || literals > in.size() - pos || literals > out.size() - o) {
+            return false;
+        }
+        std::memcpy(out.data() + o, in.data() + pos, literals);
+        pos += literals;
+        o += literals;
+
+        if (!get_varint(in, pos, len)) {
+            return false;
+        }
+        if (len == 0) {
+            return o == out.size();
+        }
+        if (!get_varint(in, pos, offset) || offset == 0 || offset > o || len > out.size() - o) {
+            return false;
+        }
+        // Byte by byte, since a match may overlap its own output
+        for (std::size_t k = 0; k < len; ++k, ++o) {
+            out[o] = out[o - offset];
+        }
+    }
+}
+
+// Compressed world snapshots. Each column (alive flags, then every pool) is
+// written in blocks of SnapshotBlock entities: the presence mask as
+// alternating run lengths starting with absent, then the component bytes
+// (zeroed where absent) XORed with the same bytes of the previous snapshot,
+// the whole block passed through lz_compress. Unchanged data XORs to zeros
+// and compresses to almost nothing. Encoding and decoding hold one block at a
+// time; the codec keeps the previous snapshot's bytes as the delta reference.
+// Writer and reader each need their own codec and must see the same sequence
+// of snapshots since the last keyframe; reset() starts a new keyframe.
+inline constexpr char SnapshotMagic[8] = {'E', 'C', 'S', 'N', 'A', 'P', '0', '1'};
+inline constexpr std::size_t SnapshotBlock = 4096;
+
+struct SnapshotCodec {
+    std::unordered_map<std::string, std::vector<std::uint8_t>> previous;
+    std::uint64_t sequence = 0;
+
+    auto reset() -> void {
+        previous.clear();
+        sequence = 0;
+    }
+};
+
+inline auto save_snapshot(World &w, std::ostream &out, SnapshotCodec &codec) -> Status {
+    const auto rows = static_cast<std::size_t>(w.nextEntity);
+    std::vector<std::uint8_t> head;
+    auto flush = [&] {
+        out.write(reinterpret_cast<const char*>(head.data()), static_cast<std::streamsize>(head.size()));
+        head.clear();
+    };
+
+    out.write(SnapshotMagic, sizeof(SnapshotMagic));
+    put_varint(head, codec.sequence);
+    put_varint(head, rows);
+    put_varint(head, 1 + static_cast<std::size_t>(std::count_if(w.pools.begin(), w.pools.end(), [](auto &p) { return p != nullptr; })));
+    flush();
+
+    std::vector<std::uint8_t> raw;
+    std::vector<std::uint8_t> packed;
+    // Sparse-layout pools are read per entity so saving does not densify them
+    auto column = [&](std::string_view name, const char *mask, PoolBase *pool) {
+        const auto size = pool ? pool->elemSize : 0;
+        const auto *data = pool && pool->contiguous() ? static_cast<const std::uint8_t*>(pool->rawData()) : nullptr;
+        put_varint(head, name.size());
+        head.insert(head.end(), name.begin(), name.end());
+        put_varint(head, size);
+        flush();
+
+        auto &ref = codec.previous[std::string(name)];
+        ref.resize(rows * size);
+
+        for (std::size_t begin = 0; begin < rows; begin += SnapshotBlock) {
+            const auto end = std::min(rows, begin + SnapshotBlock);
+            raw.clear();
+
+            char current = 0;
+            std::size_t run = 0;
+            for (auto e = begin; e < end; ++e) {
+                if ((mask[e] != 0) != (current != 0)) {
+                    put_varint(raw, run);
+                    current = !current;
+                    run = 0;
+                }
+                ++run;
+            }
+            put_varint(raw, run);
+
+            // Mask-only columns (alive flags) have no data bytes
+            const auto offset = raw.size();
+            raw.resize(offset + (end - begin) * size);
+            auto *dst = raw.data() + offset;
+            for (auto e = begin; size > 0 && e < end; ++e, dst += size) {
+                auto *prev = ref.data() + e * size;
+                if (mask[e]) {
+                    const auto *src = data ? data + e * size : static_cast<const std::uint8_t*>(pool->rawAt(e));
+                    for (std::size_t k = 0; k < size; ++k) {
+                        dst[k] = src[k] ^ prev[k];
+                    }
+                    std::memcpy(prev, src, size);
+                } else {
+                    std::memcpy(dst, prev, size);
+                    std::memset(prev, 0, size);
+                }
+            }
+
+            lz_compress(raw, packed);
+            put_varint(head, raw.size());
+            put_varint(head, packed.size());
+            flush();
+            out.write(reinterpret_cast<const char*>(packed.data()), static_cast<std::streamsize>(packed.size()));
+        }
+    };
+
+    column(EntityColumn, w.alive.data(), nullptr);
+    for (auto &p : w.pools) {
+        if (p) {
+            column(p->name, p->mask.data(), p.get());
+        }
+    }
+
+    ++codec.sequence;
+    return out ? Status::OK : Status::ERROR;
+}
+
+// Replace the world's entities with the snapshot's. Pools are matched by
+// name; columns of unregistered types are decoded (to keep the delta
+// reference in step) and dropped.
+inline auto load_snapshot(World &w, std::istream &in, SnapshotCodec &codec) -> Status {
+    auto getVarint = [&](std::uint64_t &v) {
+        v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            const auto c = in.get();
+            if (c == std::char_traits<char>::eof()) {
+                return false;
+            }
+            v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+            if (!(c & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    char magic[sizeof(SnapshotMagic)];
+    std::uint64_t sequence = 0, rows = 0, columns = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, SnapshotMagic, sizeof(magic)) != 0 ||
+        !getVarint(sequence) || !getVarint(rows) || !getVarint(columns)) {
+        return Status::ERROR;
+    }
+    if (sequence == 0) {
+        codec.previous.clear();
+    } else if (sequence != codec.sequence) {
+        return Status::ERROR;
+    }
+
+    clear(w);
+    if (rows > 0 && !w.ensureEntity(rows - 1)) {
+        return Status::ERROR;
+    }
+    w.nextEntity = static_cast<Entity>(rows);
+
+    std::vector<std::uint8_t> raw;
+    std::vector<std::uint8_t> packed;
+    std::string name;
+    for (std::uint64_t c = 0; c < columns; ++c) {
+        std::uint64_t len = 0, size = 0;
+        if (!getVarint(len) || len > 4096) {
+            return Status::ERROR;
+        }
+        name.resize(len);
+        if (!in.read(name.data(), static_cast<std::streamsize>(len)) || !getVarint(size)) {
+            return Status::ERROR;
+        }
+
+        char *mask = nullptr;
+        std::uint8_t *data = nullptr;
+        PoolBase *pool = nullptr;
+        if (name == EntityColumn) {
+            mask = w.alive.data();
+        } else if (const auto tid = find_component(w, name); tid != NullType) {
+            pool = w.pools[tid].get();
+            if (pool->elemSize != size) {
+                return Status::ERROR;
+            }
+            mask = pool->mask.data();
+            data = static_cast<std::uint8_t*>(pool->rawData());
+        }
+
+        auto &ref = codec.previous[name];
+        ref.resize(rows * size);
+
+        for (std::size_t begin = 0; begin < rows; begin += SnapshotBlock) {
+            const auto end = std::min<std::size_t>(rows, begin + SnapshotBlock);
+            std::uint64_t rawSize = 0, packedSize = 0;
+            // Runs take at most 10 bytes per entity, so this bounds the block
+            if (!getVarint(rawSize) || !getVarint(packedSize) ||
+                rawSize > (end - begin) * (size + 10) + 10 || packedSize > 2 * rawSize + 64) {
+                return Status::ERROR;
+            }
+            raw.resize(rawSize);
+            packed.resize(packedSize);
+            if (!in.read(reinterpret_cast<char*>(packed.data()), static_cast<std::streamsize>(packedSize)) ||
+                !lz_decompress(packed, raw)) {
+                return Status::ERROR;
+            }
+
+            std::size_t pos = 0;
+            char current = 0;
+            for (auto e = begin; e < end; current = !current) {
+                std::uint64_t run = 0;
+                if (!get_varint(raw, pos, run) || run > end - e) {
+                    return Status::ERROR;
+                }
+                for (; run > 0; --run, ++e) {
+                    if (mask) {
+                        mask[e] = current;
+                    }
+                }
+            }
+            if (rawSize - pos != (end - begin) * size) {
+                return Status::ERROR;
+            }
+
+            for (auto e = begin; e < end; ++e) {
+                auto *prev = ref.data() + e * size;
+                for (std::size_t b = 0; b < size; ++b) {
+                    prev[b] ^= raw[pos++];
+                }
+                if (data && mask[e]) {
+                    std::memcpy(data + e * size, prev, size);
+                }
+            }
+        }
+
+        if (pool) {
+            pool->refresh();
+        }
+    }
+
+    codec.sequence = sequence + 1;
+    return Status::OK;
+}
+
+} // namespace ec
+
+// Coroutines returning Task with World& as first parameter pool their frames
+template<typename... Args>
+struct std::coroutine_traits<ec::Task, ec::World&, Args...> {
+    using promise_type = ec::Task::WorldPromise<Args...>;
+};
 
 #endif // EC_HPP
 
@@ -0,0 +1,324 @@
+// End-to-end scenario benchmarks on top of ec.hpp.
+//
+// Usage: ec_scenarios [scenario|all] [entities] [ticks] [density]
+//   scenario: particles | boids | rpg | strategy | all (default)
+//   entities: entity count per scenario (default 100000)
+//   ticks:    simulated ticks (default 200)
+//   density:  fraction of entities carrying each optional component (default 0.1)
+
+#include "ec.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace ec;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Seconds since start; scenarios time only their tick loop, not the setup
+auto seconds_since(Clock::time_point start) -> double {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Config {
+    std::size_t entities = 100000;
+    std::size_t ticks    = 200;
+    double density       = 0.1;
+};
+
+struct Position { float x, y; };
+struct Velocity { float vx, vy; };
+struct Lifetime { int ticksLeft; };
+
+// Keeps results observable so the optimizer cannot drop the work
+static volatile double sink = 0.0;
+
+// Particles: constant spawn/despawn churn, every particle lives ~50 ticks
+auto particles(const Config &cfg) -> double {
+    World w;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+    const auto lifetime = 50;
+    const auto spawnPerTick = std::max<std::size_t>(1, cfg.entities / lifetime);
+
+    auto spawn = [&](std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            auto e = create_entity(w);
+            add_component<Position>(w, e, {0, 0});
+            add_component<Velocity>(w, e, {dir(rng), dir(rng)});
+            add_component<Lifetime>(w, e, {static_cast<int>(rng() % lifetime) + 1});
+        }
+    };
+    spawn(cfg.entities);
+
+    std::vector<Entity> dead;
+    const auto start = Clock::now();
+    for (std::size_t t = 0; t < cfg.ticks; ++t) {
+        query<Position, Velocity>(w, [](Entity, Position *p, Velocity *v) {
+            p->x += v->vx;
+            p->y += v->vy;
+            v->vy -= 0.01f;
+        });
+
+        dead.clear();
+        query<Lifetime>(w, [&](Entity e, Lifetime *l) {
+            if (--l->ticksLeft <= 0) {
+                dead.push_back(e);
+            }
+        });
+        for (auto e : dead) {
+            destroy_entity(w, e);
+        }
+
+        spawn(spawnPerTick);
+    }
+    return seconds_since(start);
+}
+
+// Boids: steering from neighbours found through a uniform grid
+struct Boid { int cell; };
+
+auto boids(const Config &cfg) -> double {
+    World w;
+    std::mt19937 rng(2);
+    const float size = std::sqrt(static_cast<float>(cfg.entities)) * 4.0f;
+    const float cellSize = 8.0f;
+    const int cells = static_cast<int>(size / cellSize) + 1;
+    std::uniform_real_distribution<float> pos(0.0f, size);
+    std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+
+    for (std::size_t i = 0; i < cfg.entities; ++i) {
+        auto e = create_entity(w);
+        add_component<Position>(w, e, {pos(rng), pos(rng)});
+        add_component<Velocity>(w, e, {dir(rng), dir(rng)});
+        add_component<Boid>(w, e, {0});
+    }
+
+    auto cellOf = [&](float x, float y) {
+        const auto cx = std::clamp(static_cast<int>(x / cellSize), 0, cells - 1);
+        const auto cy = std::clamp(static_cast<int>(y / cellSize), 0, cells - 1);
+        return cy * cells + cx;
+    };
+
+    std::vector<std::vector<Entity>> grid(static_cast<std::size_t>(cells * cells));
+    const auto start = Clock::now();
+    for (std::size_t t = 0; t < cfg.ticks; ++t) {
+        for (auto &c : grid) {
+            c.clear();
+        }
+        query<Position, Boid>(w, [&](Entity e, Position *p, Boid *b) {
+            b->cell = cellOf(p->x, p->y);
+            grid[static_cast<std::size_t>(b->cell)].push_back(e);
+        });
+
+        // Alignment and cohesion against the boid's own cell
+        query<Position, Velocity, Boid>(w, [&](Entity e, Position *p, Velocity *v, Boid *b) {
+            float ax = 0, ay = 0, cx = 0, cy = 0;
+            std::size_t n = 0;
+            for (auto other : grid[static_cast<std::size_t>(b->cell)]) {
+                if (other == e) {
+                    continue;
+                }
+                auto *op = get_component<Position>(w, other);
+                auto *ov = get_component<Velocity>(w, other);
+                ax += ov->vx;
+                ay += ov->vy;
+                cx += op->x;
+                cy += op->y;
+                ++n;
+            }
+            if (n > 0) {
+                const auto inv = 1.0f / static_cast<float>(n);
+                v->vx += (ax * inv - v->vx) * 0.05f + (cx * inv - p->x) * 0.001f;
+                v->vy += (ay * inv - v->vy) * 0.05f + (cy * inv - p->y) * 0.001f;
+            }
+        });
+
+        query<Position, Velocity>(w, [&](Entity, Position *p, Velocity *v) {
+            p->x = std::fmod(p->x + v->vx + size, size);
+            p->y = std::fmod(p->y + v->vy + size, size);
+        });
+    }
+    return seconds_since(start);
+}
+
+// RPG server: everyone has Health, everything else is sparse
+struct Health { int hp, maxHp; };
+struct Regen { int perTick; };
+struct Poison { int perTick, ticksLeft; };
+struct Buff { float multiplier; int ticksLeft; };
+struct Inventory { int gold, items; };
+struct Quest { int stage; };
+struct Cooldown { int ticksLeft; };
+struct Aggro { Entity target; };
+
+auto rpg(const Config &cfg) -> double {
+    World w;
+    std::mt19937 rng(3);
+    std::bernoulli_distribution has(cfg.density);
+
+    for (std::size_t i = 0; i < cfg.entities; ++i) {
+        auto e = create_entity(w);
+        add_component<Health>(w, e, {100, 100});
+        if (has(rng)) add_component<Regen>(w, e, {2});
+        if (has(rng)) add_component<Poison>(w, e, {3, 20});
+        if (has(rng)) add_component<Buff>(w, e, {1.5f, 30});
+        if (has(rng)) add_component<Inventory>(w, e, {0, 0});
+        if (has(rng)) add_component<Quest>(w, e, {0});
+        if (has(rng)) add_component<Cooldown>(w, e, {0});
+        if (has(rng)) add_component<Aggro>(w, e, {static_cast<Entity>(rng() % cfg.entities)});
+    }
+
+    std::vector<Entity> expired;
+    const auto start = Clock::now();
+    for (std::size_t t = 0; t < cfg.ticks; ++t) {
+        query<Health, Regen>(w, [](Entity, Health *h, Regen *r) {
+            h->hp = std::min(h->maxHp, h->hp + r->perTick);
+        });
+
+        expired.clear();
+        query<Health, Poison>(w, [&](Entity e, Health *h, Poison *p) {
+            h->hp -= p->perTick;
+            if (--p->ticksLeft <= 0) {
+                expired.push_back(e);
+            }
+        });
+        for (auto e : expired) {
+            remove_component<Poison>(w, e);
+        }
+
+        query<Buff>(w, [](Entity, Buff *b) { b->ticksLeft = std::max(0, b->ticksLeft - 1); });
+        query<Inventory, Quest>(w, [](Entity, Inventory *inv, Quest *q) {
+            inv->gold += q->stage;
+            q->stage = (q->stage + 1) % 10;
+        });
+
+        // Aggro resolves targets through random access
+        query<Aggro, Cooldown>(w, [&](Entity, Aggro *a, Cooldown *c) {
+            if (c->ticksLeft > 0) {
+                --c->ticksLeft;
+                return;
+            }
+            if (auto *h = get_component<Health>(w, a->target)) {
+                h->hp -= 5;
+                c->ticksLeft = 3;
+            }
+        });
+
+        // Periodically re-poison a slice of the population
+        for (std::size_t i = t % 10; i < cfg.entities; i += 97) {
+            if (!get_component<Poison>(w, static_cast<Entity>(i))) {
+                add_component<Poison>(w, static_cast<Entity>(i), {1, 10});
+            }
+        }
+    }
+    return seconds_since(start);
+}
+
+// Strategy sim: army -> squad -> unit hierarchy with transform propagation
+struct Parent { Entity parent; };
+struct Local { float x, y; };
+struct WorldPos { float x, y; };
+struct Depth { int level; };
+
+auto strategy(const Config &cfg) -> double {
+    World w;
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> off(-10.0f, 10.0f);
+    const std::size_t squadSize = 16;
+    const std::size_t armySize  = 16;
+
+    auto spawn = [&](int level, Entity parent) {
+        auto e = create_entity(w);
+        add_component<Local>(w, e, {off(rng), off(rng)});
+        add_component<WorldPos>(w, e, {0, 0});
+        add_component<Depth>(w, e, {level});
+        if (parent != NullEntity) {
+            add_component<Parent>(w, e, {parent});
+        }
+        return e;
+    };
+
+    Entity army  = NullEntity;
+    Entity squad = NullEntity;
+    for (std::size_t i = 0; i < cfg.entities; ++i) {
+        if (i % (squadSize * armySize) == 0) {
+            army = spawn(0, NullEntity);
+            squad = NullEntity;
+        } else if (i % squadSize == 0) {
+            squad = spawn(1, army);
+        } else {
+            spawn(2, squad != NullEntity ? squad : army);
+        }
+    }
+
+    const auto start = Clock::now();
+    for (std::size_t t = 0; t < cfg.ticks; ++t) {
+        // Roots drift, then each level resolves against its parent
+        query<Local, WorldPos, Depth>(w, [](Entity, Local *l, WorldPos *wp, Depth *d) {
+            if (d->level == 0) {
+                l->x += 0.5f;
+                *wp = {l->x, l->y};
+            }
+        });
+        for (int level = 1; level <= 2; ++level) {
+            query<Local, WorldPos, Depth, Parent>(w, [&](Entity, Local *l, WorldPos *wp, Depth *d, Parent *p) {
+                if (d->level != level) {
+                    return;
+                }
+                auto *pw = get_component<WorldPos>(w, p->parent);
+                *wp = {pw->x + l->x, pw->y + l->y};
+            });
+        }
+
+        double cx = 0.0;
+        query<WorldPos>(w, [&](Entity, WorldPos *wp) { cx += wp->x; });
+        sink = cx;
+    }
+    return seconds_since(start);
+}
+
+struct Scenario {
+    const char *name;
+    double (*run)(const Config&);
+};
+
+constexpr Scenario scenarios[] = {
+    {"particles", particles},
+    {"boids",     boids},
+    {"rpg",       rpg},
+    {"strategy",  strategy},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const std::string which = argc > 1 ? argv[1] : "all";
+    Config cfg;
+    if (argc > 2) cfg.entities = std::strtoull(argv[2], nullptr, 10);
+    if (argc > 3) cfg.ticks    = std::strtoull(argv[3], nullptr, 10);
+    if (argc > 4) cfg.density  = std::strtod(argv[4], nullptr);
+
+    bool ran = false;
+    for (auto &s : scenarios) {
+        if (which != "all" && which != s.name) {
+            continue;
+        }
+
+        const auto secs = s.run(cfg);
+        std::printf("%-10s entities=%zu ticks=%zu density=%.2f  %.1f ticks/s\n",
+                    s.name, cfg.entities, cfg.ticks, cfg.density, static_cast<double>(cfg.ticks) / secs);
+        ran = true;
+    }
+
+    if (!ran) {
+        std::fprintf(stderr, "unknown scenario '%s' (particles, boids, rpg, strategy, all)\n", which.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -1,18 +1,91 @@
 #include "catch2/catch_test_macros.hpp"
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
+// Tests cover the traced build; recording stays off unless World::trace is set
+#define EC_TRACE
+#define EC_FIELD_STATS
 #include "ec.hpp"
 #include <chrono>
 #include <random>
 #include <numeric>
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
 
 using namespace ec;
 
+// Counting global allocator so tests can assert allocation-free paths. Every
+// form of new/delete is replaced so all of them share one heap; the heap calls
+// stay out of line so GCC does not match the inlined free against new.
+static std::atomic<std::size_t> allocationCount{0};
+
+[[gnu::noinline]] static void* counted_alloc(std::size_t n, std::size_t align) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    n = n ? n : 1;
+    if (align <= alignof(std::max_align_t)) {
+        return std::malloc(n);
+    }
+    return std::aligned_alloc(align, (n + align - 1) / align * align);
+}
+
+[[gnu::noinline]] static void counted_free(void *p) noexcept { std::free(p); }
+
+static void* counted_alloc_or_throw(std::size_t n, std::size_t align) {
+    if (void *p = counted_alloc(n, align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t n) { return counted_alloc_or_throw(n, 0); }
+void* operator new[](std::size_t n) { return counted_alloc_or_throw(n, 0); }
+void* operator new(std::size_t n, std::align_val_t a) { return counted_alloc_or_throw(n, static_cast<std::size_t>(a)); }
+void* operator new[](std::size_t n, std::align_val_t a) { return counted_alloc_or_throw(n, static_cast<std::size_t>(a)); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(n, static_cast<std::size_t>(a)); }
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(n, static_cast<std::size_t>(a)); }
+
+void operator delete(void *p) noexcept { counted_free(p); }
+void operator delete[](void *p) noexcept { counted_free(p); }
+void operator delete(void *p, std::size_t) noexcept { counted_free(p); }
+void operator delete[](void *p, std::size_t) noexcept { counted_free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+
 struct Position { float x, y; };
 struct Velocity { float vx, vy; };
 struct Health { int hp; };
 
+enum class State : std::uint8_t { Idle, Patrol, Attack, Flee };
+
+template<>
+struct ec::component_storage<State> {
+    using type = PartitionedPool<State, 4>;
+};
+
+struct Buffs { float damage, armor, speed, regen; int stacks; };
+
+template<>
+struct ec::component_storage<Buffs> {
+    using type = AdaptivePool<Buffs>;
+};
+
+struct History { float samples[16]; int count; };
+
+template<>
+struct ec::component_storage<History> {
+    using type = MappedPool<History>;
+};
+
 TEST_CASE("Entity creation and destruction", "[entity]") {
     World world;
 
@@ -160,3 +233,1338 @@ TEST_CASE("Cache-friendly access pattern", "[performance]") {
     REQUIRE(sum1 == sum2);
     REQUIRE(durCont < durRand);
 }
+
+static auto walk(World &w, Entity e, int steps, JobCounter &job) -> Task {
+    for (int i = 0; i < steps; ++i) {
+        get_component<Position>(w, e)->x += 1.0f;
+        co_await next_tick();
+    }
+    co_await job;
+    get_component<Health>(w, e)->hp = 0;
+}
+
+TEST_CASE("Coroutine systems suspend across ticks", "[coroutine]") {
+    World world;
+    Entity e = create_entity(world);
+    add_component<Position>(world, e, {0,0});
+    add_component<Health>(world, e, {10});
+
+    JobCounter job;
+    job.add();
+    spawn(world, walk(world, e, 3, job));
+
+    // Frame lives in the world's pool, nothing runs before the first tick
+    REQUIRE(!world.frames.blocks.empty());
+    REQUIRE(get_component<Position>(world, e)->x == Catch::Approx(0.0f));
+
+    for (int i = 0; i < 5; ++i) {
+        tick(world);
+    }
+    REQUIRE(get_component<Position>(world, e)->x == Catch::Approx(3.0f));
+    REQUIRE(get_component<Health>(world, e)->hp == 10);
+
+    // Parked on the job until it completes
+    job.done();
+    tick(world);
+    REQUIRE(get_component<Health>(world, e)->hp == 0);
+    REQUIRE(world.scheduler.ready.empty());
+    REQUIRE(world.scheduler.waiting.empty());
+}
+
+TEST_CASE("Entity migration between worlds", "[world][migrate]") {
+    World src;
+    World dst;
+
+    // Register types in a different order so type IDs differ between worlds
+    Entity d0 = create_entity(dst);
+    add_component<Health>(dst, d0, {1});
+
+    Entity a = create_entity(src);
+    Entity b = create_entity(src);
+    add_component<Position>(src, a, {1,2});
+    add_component<Health>(src, a, {7});
+    add_component<Position>(src, b, {3,4});
+
+    std::vector<Entity> ids = {a, b};
+    std::vector<Entity> out;
+    REQUIRE(migrate_entities(src, dst, ids, out) == Status::OK);
+    REQUIRE(out.size() == 2);
+
+    REQUIRE(get_component<Position>(dst, out[0])->y == Catch::Approx(2.0f));
+    REQUIRE(get_component<Health>(dst, out[0])->hp == 7);
+    REQUIRE(get_component<Health>(dst, out[1]) == nullptr);
+    REQUIRE(get_component<Position>(src, a) == nullptr);
+
+    std::size_t remaining = 0;
+    query<Position>(src, [&](Entity, Position*) { ++remaining; });
+    REQUIRE(remaining == 0);
+}
+
+TEST_CASE("Region sharding migrates entities crossing borders", "[world][migrate]") {
+    ShardSet set(2);
+    auto left  = create_entity(set, 0);
+    auto right = create_entity(set, 0);
+    add_component<Position>(*set.shards[0], locate(set, left)->entity, {-5, 0});
+    add_component<Position>(*set.shards[0], locate(set, right)->entity, {5, 0});
+
+    std::size_t moved = 0;
+    REQUIRE(rebalance<Position>(set, [](const Position &p) { return p.x < 0 ? 0 : 1; }, moved) == Status::OK);
+    REQUIRE(moved == 1);
+    REQUIRE(locate(set, left)->shard == 0);
+    REQUIRE(locate(set, right)->shard == 1);
+
+    auto *loc = locate(set, right);
+    REQUIRE(get_component<GlobalId>(*set.shards[1], loc->entity)->id == right);
+    REQUIRE(get_component<Position>(*set.shards[1], loc->entity)->x == Catch::Approx(5.0f));
+
+    const auto local = loc->entity;
+    REQUIRE(destroy_entity(set, right) == Status::OK);
+    REQUIRE(locate(set, right) == nullptr);
+    REQUIRE(!set.shards[1]->alive[local]);
+    REQUIRE(destroy_entity(set, right) == Status::ERROR);
+
+    // A full shard hands out no id and leaves the counter alone
+    set.shards[1]->memoryBudget = 1;
+    while (create_entity(*set.shards[1]) != NullEntity) {
+    }
+    const auto next = set.nextGlobal;
+    REQUIRE(create_entity(set, 1) == NullGlobal);
+    REQUIRE(set.nextGlobal == next);
+
+    // Migration into the full shard fails and is reported
+    REQUIRE(rebalance<Position>(set, [](const Position &) { return 1; }, moved) == Status::ERROR);
+    REQUIRE(locate(set, left)->shard == 0);
+}
+
+TEST_CASE("Thread pool runs jobs and signals counters", "[parallel]") {
+    ThreadPool pool(4);
+    JobCounter counter;
+    std::atomic<int> sum{0};
+
+    for (int i = 1; i <= 100; ++i) {
+        pool.submit(counter, [&sum, i] { sum += i; });
+    }
+    pool.wait(counter);
+
+    REQUIRE(counter.finished());
+    REQUIRE(sum == 5050);
+}
+
+TEST_CASE("Parallel stepping of independent worlds", "[parallel][world]") {
+    ThreadPool pool(4);
+    std::vector<std::unique_ptr<World>> rooms;
+    for (int r = 0; r < 200; ++r) {
+        auto w = std::make_unique<World>();
+        for (int i = 0; i <= r % 7; ++i) {
+            add_component<Health>(*w, create_entity(*w), {r});
+        }
+        rooms.push_back(std::move(w));
+    }
+
+    step_worlds(pool, rooms, [](World &w) {
+        query<Health>(w, [](Entity, Health *h) { h->hp += 1000; });
+    }, 16);
+
+    for (int r = 0; r < 200; ++r) {
+        std::size_t n = 0;
+        query<Health>(*rooms[r], [&](Entity, Health *h) {
+            REQUIRE(h->hp == r + 1000);
+            ++n;
+        });
+        REQUIRE(n == static_cast<std::size_t>(r % 7 + 1));
+    }
+}
+
+TEST_CASE("Parallel query with chunk affinity", "[parallel][query]") {
+    ThreadPool pool(4);
+    World world;
+    const std::size_t N = 10000;
+    for (std::size_t i = 0; i < N; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {static_cast<float>(i), 0});
+        if (i % 3 == 0) {
+            add_component<Velocity>(world, e, {1, 2});
+        }
+    }
+
+    // Placement is a no-op unless built with EC_NUMA on a multi-node machine
+    REQUIRE(numa_place(world, pool, 1000) == Status::OK);
+
+    std::atomic<std::size_t> matched{0};
+    par_query<Position, Velocity>(world, pool, [&](Entity, Position *p, Velocity *v) {
+        p->y += v->vy;
+        ++matched;
+    }, 1000);
+
+    REQUIRE(matched == (N + 2) / 3);
+    REQUIRE(get_component<Position>(world, 3)->y == Catch::Approx(2.0f));
+    REQUIRE(get_component<Position>(world, 4)->y == Catch::Approx(0.0f));
+
+    // Chunks are pinned: neither stealing nor the waiting thread moves them
+    std::atomic<std::size_t> misplaced{0};
+    for (int round = 0; round < 10; ++round) {
+        par_query<Position>(world, pool, [&](Entity e, Position*) {
+            if (currentWorker != (e / 1000) % pool.size()) {
+                ++misplaced;
+            }
+        }, 1000);
+    }
+    REQUIRE(misplaced == 0);
+}
+
+TEST_CASE("Bulk merge and copy between worlds", "[world][merge]") {
+    World level;
+    for (int i = 0; i < 10; ++i) {
+        auto e = create_entity(level);
+        add_component<Position>(level, e, {static_cast<float>(i), 0});
+        if (i % 2 == 0) {
+            add_component<Health>(level, e, {i});
+        }
+    }
+    destroy_entity(level, 9);
+
+    World dst;
+    Entity existing = create_entity(dst);
+    add_component<Velocity>(dst, existing, {1, 1});
+
+    auto remap = merge(dst, level);
+    REQUIRE(remap.size() == 10);
+    REQUIRE(remap[0] == 1);
+    REQUIRE(remap[9] == NullEntity);
+    REQUIRE(get_component<Position>(dst, remap[4])->x == Catch::Approx(4.0f));
+    REQUIRE(get_component<Health>(dst, remap[4])->hp == 4);
+    REQUIRE(get_component<Health>(dst, remap[5]) == nullptr);
+
+    std::size_t count = 0;
+    query<Position>(dst, [&](Entity, Position*) { ++count; });
+    REQUIRE(count == 9);
+
+    std::vector<Entity> pick = {2, 3, 4, 7};
+    auto copied = copy_entities(dst, level, pick);
+    REQUIRE(copied.size() == 4);
+    REQUIRE(get_component<Position>(dst, copied[3])->x == Catch::Approx(7.0f));
+    REQUIRE(get_component<Health>(dst, copied[0])->hp == 2);
+    REQUIRE(get_component<Health>(dst, copied[1]) == nullptr);
+    REQUIRE(get_component<Position>(level, 7) != nullptr);
+}
+
+static int scriptLive = 0;
+
+TEST_CASE("Runtime-defined component types", "[component][runtime]") {
+    struct Script { double a; int b; };
+
+    World world;
+    ComponentInfo info;
+    info.size      = sizeof(Script);
+    info.align     = alignof(Script);
+    info.construct = [](void *p) { new (p) Script{0.0, 0}; ++scriptLive; };
+    info.destroy   = [](void *) { --scriptLive; };
+
+    {
+        World scoped;
+        register_component(scoped, "Script", info);
+        create_entity(scoped);
+        REQUIRE(scriptLive > 0);
+    }
+    REQUIRE(scriptLive == 0);
+
+    const auto scriptId = register_component(world, "Script", info);
+    REQUIRE(register_component(world, "Script", info) == scriptId);
+    REQUIRE(find_component(world, "Script") == scriptId);
+    REQUIRE(find_component(world, "Missing") == NullType);
+
+    const auto posId = register_component<Position>(world);
+    REQUIRE(find_component(world, typeid(Position).name()) == posId);
+
+    std::vector<Entity> es;
+    for (int i = 0; i < 40; ++i) {
+        auto e = create_entity(world);
+        es.push_back(e);
+        add_component<Position>(world, e, {static_cast<float>(i), 0});
+        if (i % 4 == 0) {
+            Script s{i * 0.5, i};
+            REQUIRE(add_component(world, e, scriptId, &s) == Status::OK);
+        }
+    }
+
+    auto *s8 = static_cast<Script*>(get_component(world, es[8], scriptId));
+    REQUIRE(s8 != nullptr);
+    REQUIRE(s8->b == 8);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(s8) % alignof(Script) == 0);
+    REQUIRE(get_component(world, es[9], scriptId) == nullptr);
+
+    REQUIRE(remove_component(world, es[4], scriptId) == Status::OK);
+
+    std::vector<std::size_t> ids = {posId, scriptId};
+    int sum = 0;
+    query_dynamic(world, ids, [&](Entity e, void* const* ptrs) {
+        auto *p = static_cast<Position*>(ptrs[0]);
+        auto *s = static_cast<Script*>(ptrs[1]);
+        REQUIRE(p->x == Catch::Approx(static_cast<float>(e)));
+        sum += s->b;
+    });
+    REQUIRE(sum == 0 + 8 + 12 + 16 + 20 + 24 + 28 + 32 + 36);
+}
+
+TEST_CASE("Columnar export in Arrow layout", "[export]") {
+    World world;
+    for (int i = 0; i < 20; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {static_cast<float>(i), 1});
+        if (i % 5 == 0) {
+            add_component<Health>(world, e, {i});
+        }
+    }
+    destroy_entity(world, 1);
+
+    ArrowArray array;
+    ArrowSchema schema;
+    const auto hid = world.getTypeId<Health>();
+    REQUIRE(export_column(world, hid, &array, &schema) == Status::OK);
+    REQUIRE(std::string(schema.format) == "w:" + std::to_string(sizeof(Health)));
+    REQUIRE(array.length == 20);
+    REQUIRE(array.null_count == 16);
+
+    // Data is zero-copy, validity is packed alive && mask
+    auto *pool = static_cast<Pool<Health>*>(world.pools[hid].get());
+    REQUIRE(array.buffers[1] == pool->data.data());
+    auto *bits = static_cast<const std::uint8_t*>(array.buffers[0]);
+    REQUIRE(bits[0] == 0x21);
+    REQUIRE(bits[1] == 0x84);
+    array.release(&array);
+    schema.release(&schema);
+    REQUIRE(array.release == nullptr);
+
+    REQUIRE(export_world(world, &array, &schema) == Status::OK);
+    REQUIRE(std::string(schema.format) == "+s");
+    REQUIRE(schema.n_children == 2);
+    REQUIRE(array.null_count == 1);
+    REQUIRE(array.children[0]->length == 20);
+    array.release(&array);
+    schema.release(&schema);
+
+    const std::string path = "ec_columns_test.bin";
+    REQUIRE(write_columns(world, path) == Status::OK);
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    REQUIRE(in.tellg() % static_cast<std::streamoff>(ColumnAlign) == 0);
+    in.close();
+
+    // Empty and cleared worlds have no rows at all
+    World empty;
+    REQUIRE(write_columns(empty, path) == Status::OK);
+    clear(world);
+    REQUIRE(write_columns(world, path) == Status::OK);
+    World loaded;
+    register_component<Position>(loaded);
+    REQUIRE(load_columns(loaded, path) == Status::OK);
+    REQUIRE(loaded.nextEntity == 0);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Bulk loading from column files", "[export][load]") {
+    World src;
+    for (int i = 0; i < 50; ++i) {
+        auto e = create_entity(src);
+        add_component<Position>(src, e, {static_cast<float>(i), static_cast<float>(-i)});
+        if (i % 3 == 0) {
+            add_component<Health>(src, e, {i});
+        }
+    }
+    destroy_entity(src, 10);
+
+    const std::string path = "ec_load_test.bin";
+    REQUIRE(write_columns(src, path) == Status::OK);
+
+    ThreadPool pool(2);
+    World dst;
+    register_component<Position>(dst);
+    register_component<Health>(dst);
+    REQUIRE(load_columns(dst, path, &pool) == Status::OK);
+
+    REQUIRE(dst.nextEntity == 50);
+    REQUIRE(!dst.alive[10]);
+    REQUIRE(get_component<Position>(dst, 49)->y == Catch::Approx(-49.0f));
+    REQUIRE(get_component<Health>(dst, 9)->hp == 9);
+    REQUIRE(get_component<Health>(dst, 8) == nullptr);
+
+    // Reverse the entity IDs in the file to exercise the scattered path
+    {
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+        std::uint64_t idsOffset = 0;
+        f.seekg(8 + 8 + 8 + 4 + static_cast<std::streamoff>(EntityColumn.size()) + 8 + 8);
+        f.read(reinterpret_cast<char*>(&idsOffset), sizeof(idsOffset));
+        std::vector<Entity> ids(50);
+        for (Entity i = 0; i < 50; ++i) {
+            ids[i] = 49 - i;
+        }
+        f.seekp(static_cast<std::streamoff>(idsOffset));
+        f.write(reinterpret_cast<const char*>(ids.data()), 50 * sizeof(Entity));
+    }
+
+    World reversed;
+    register_component<Position>(reversed);
+    register_component<Health>(reversed);
+    REQUIRE(load_columns(reversed, path) == Status::OK);
+    REQUIRE(get_component<Position>(reversed, 0)->x == Catch::Approx(49.0f));
+    REQUIRE(get_component<Health>(reversed, 49 - 9)->hp == 9);
+    REQUIRE(!reversed.alive[49 - 10]);
+
+    // Corrupt files are rejected before the world grows
+    std::string bytes;
+    {
+        std::ifstream f(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(f), {});
+    }
+    auto loadBytes = [&](const std::string &content) {
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            f.write(content.data(), static_cast<std::streamsize>(content.size()));
+        }
+        World world;
+        register_component<Position>(world);
+        const auto status = load_columns(world, path);
+        REQUIRE(world.alive.size() == 0);
+        return status;
+    };
+    REQUIRE(loadBytes(bytes.substr(0, bytes.size() - 64)) == Status::ERROR);
+
+    const auto reversedIds = bytes.find(std::string("\x31\0\0\0\x30\0\0\0", 8));
+    REQUIRE(reversedIds != std::string::npos);
+    auto badId = bytes;
+    const Entity huge = 1u << 30;
+    std::memcpy(badId.data() + reversedIds, &huge, sizeof(huge));
+    REQUIRE(loadBytes(badId) == Status::ERROR);
+
+    auto badRows = bytes;
+    const std::uint64_t rows = std::uint64_t(1) << 40;
+    std::memcpy(badRows.data() + 8, &rows, sizeof(rows));
+    REQUIRE(loadBytes(badRows) == Status::ERROR);
+
+    // Name lengths are checked against the file before allocating
+    auto badName = bytes;
+    const std::uint32_t len = 0xFFFFFFF0u;
+    std::memcpy(badName.data() + 8 + 8 + 8, &len, sizeof(len));
+    REQUIRE(loadBytes(badName) == Status::ERROR);
+    REQUIRE(loadBytes(bytes.substr(0, 8 + 8 + 8 + 4 + 3)) == Status::ERROR);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("API trace recording and replay", "[trace]") {
+    TraceRecorder rec;
+    World world;
+    world.trace = &rec;
+
+    for (int i = 0; i < 10; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {1, 2});
+        if (i % 2 == 0) {
+            add_component<Velocity>(world, e, {3, 4});
+        }
+    }
+    get_component<Position>(world, 3);
+    remove_component<Velocity>(world, 4);
+    query<Position, Velocity>(world, [](Entity, Position*, Velocity*) {});
+    {
+        // Calls on pool workers are not recorded
+        ThreadPool pool(2);
+        par_query<Position>(world, pool, [&](Entity e, Position*) { get_component<Velocity>(world, e); }, 4);
+    }
+    destroy_entity(world, 0);
+    world.trace = nullptr;
+    create_entity(world);
+
+    const std::string path = "ec_trace_test.bin";
+    REQUIRE(save_trace(rec, path) == Status::OK);
+    std::vector<std::uint8_t> bytes;
+    REQUIRE(load_trace(path, bytes) == Status::OK);
+    REQUIRE(bytes == rec.bytes);
+    std::remove(path.c_str());
+
+    ReplayReport report;
+    REQUIRE(replay_trace(bytes, report) == Status::OK);
+    auto count = [&](TraceOp op) { return report.replayed[static_cast<std::size_t>(op)].count; };
+    REQUIRE(count(TraceOp::Create) == 10);
+    REQUIRE(count(TraceOp::Add) == 15);
+    REQUIRE(count(TraceOp::Get) == 1);
+    REQUIRE(count(TraceOp::Remove) == 1);
+    REQUIRE(count(TraceOp::Query) == 1);
+    REQUIRE(count(TraceOp::Destroy) == 1);
+    REQUIRE(report.recorded[static_cast<std::size_t>(TraceOp::Add)].count == 15);
+}
+
+static auto idle(World &, int &ticks) -> Task {
+    while (true) {
+        ++ticks;
+        co_await next_tick();
+    }
+}
+
+TEST_CASE("Steady-state hot paths do not allocate", "[performance][alloc]") {
+    struct Unseen { int x; };
+
+    World world(1024);
+    ComponentInfo info;
+    info.size = sizeof(int);
+    const auto scriptId = register_component(world, "Counter", info);
+    const auto posId = register_component<Position>(world);
+    for (int i = 0; i < 1000; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {1, 1});
+        add_component<Velocity>(world, e, {1, 1});
+        if (i % 2 == 0) {
+            add_component<Health>(world, e, {i});
+        }
+    }
+
+    int ticks = 0;
+    spawn(world, idle(world, ticks));
+
+    std::vector<std::size_t> ids = {posId, scriptId};
+    const int value = 7;
+    auto frame = [&] {
+        tick(world);
+        query<Position, Velocity>(world, [](Entity, Position *p, Velocity *v) { p->x += v->vx; });
+        query<Unseen>(world, [](Entity, Unseen *u) { u->x = 0; });
+        query_dynamic(world, ids, [](Entity, void* const*) {});
+        for (Entity e = 0; e < 1000; e += 7) {
+            get_component<Position>(world, e);
+            get_component<Unseen>(world, e);
+            remove_component<Health>(world, e);
+            add_component<Health>(world, e, {1});
+            add_component(world, e, scriptId, &value);
+            remove_component<Unseen>(world, e);
+        }
+    };
+
+    // Warm up, then count a full frame
+    frame();
+    const auto before = allocationCount.load();
+    frame();
+    const auto allocations = allocationCount.load() - before;
+
+    REQUIRE(allocations == 0);
+    REQUIRE(ticks == 2);
+    REQUIRE(world.findTypeId<Unseen>() == NullType);
+}
+
+TEST_CASE("Value-partitioned iteration for state components", "[query][partition]") {
+    World world;
+    for (int i = 0; i < 100; ++i) {
+        auto e = create_entity(world);
+        add_component<State>(world, e, static_cast<State>(i % 4));
+        if (i % 2 == 0) {
+            add_component<Health>(world, e, {i});
+        }
+    }
+
+    auto count = [&](State s) {
+        std::size_t n = 0;
+        query_partition<State>(world, s, [&](Entity, State *st) {
+            REQUIRE(*st == s);
+            ++n;
+        });
+        return n;
+    };
+    REQUIRE(count(State::Attack) == 25);
+
+    // O(1) transitions, including from inside the bucket walk
+    query_partition<State>(world, State::Attack, [&](Entity e, State*) {
+        if (e % 3 == 0) {
+            add_component<State>(world, e, State::Flee);
+        }
+    });
+    REQUIRE(count(State::Attack) == 25 - 8);
+    REQUIRE(count(State::Flee) == 25 + 8);
+
+    remove_component<State>(world, 3);
+    REQUIRE(count(State::Flee) == 25 + 8 - 1);
+
+    std::size_t withHealth = 0;
+    query_partition<State, Health>(world, State::Idle, [&](Entity e, State*, Health *h) {
+        REQUIRE(h->hp == static_cast<int>(e));
+        ++withHealth;
+    });
+    REQUIRE(withHealth == 25);
+
+    // Regular queries and bulk copies see the same data
+    std::size_t all = 0;
+    query<State>(world, [&](Entity, State*) { ++all; });
+    REQUIRE(all == 99);
+
+    World copy;
+    merge(copy, world);
+    std::size_t fleeing = 0;
+    query_partition<State>(copy, State::Flee, [&](Entity, State*) { ++fleeing; });
+    REQUIRE(fleeing == 25 + 8 - 1);
+
+    // Keys outside [0, N) are rejected instead of indexing past the buckets
+    const auto bad = static_cast<State>(7);
+    REQUIRE(add_component<State>(world, 5, bad) == Status::ERROR);
+    REQUIRE(add_component(world, 5, world.findTypeId<State>(), &bad) == Status::ERROR);
+    REQUIRE(*get_component<State>(world, 5) == State::Patrol);
+    std::size_t none = 0;
+    query_partition<State>(world, bad, [&](Entity, State*) { ++none; });
+    REQUIRE(none == 0);
+}
+
+#if EC_VALIDATE
+static std::atomic<int> violations{0};
+
+TEST_CASE("Access validator traps undeclared component access", "[validate]") {
+    World world;
+    for (int i = 0; i < 100; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {1, 1});
+        add_component<Velocity>(world, e, {2, 2});
+        add_component<Health>(world, e, {3});
+    }
+
+    auto previous = accessViolation;
+    accessViolation = [](const AccessSet&, const char*, bool) { ++violations; };
+
+    const auto movement = declare_access<Position, const Velocity>("movement");
+    {
+        ScopedAccess scope(&movement);
+
+        query<Position, const Velocity>(world, [](Entity, Position *p, const Velocity *v) { p->x += v->vx; });
+        const Velocity *v = get_component<const Velocity>(world, 0);
+        REQUIRE(v->vx == Catch::Approx(2.0f));
+        REQUIRE(violations == 0);
+
+        // Writing a read-only component and touching an undeclared one
+        get_component<Velocity>(world, 0);
+        query<const Health>(world, [](Entity, const Health*) {});
+        REQUIRE(violations == 2);
+
+        // Parallel chunks run under the same declaration
+        ThreadPool pool(2);
+        par_query<Position, Health>(world, pool, [](Entity, Position*, Health*) {}, 10);
+        REQUIRE(violations == 2 + 10);
+    }
+
+    // Outside any declaration nothing is checked
+    get_component<Health>(world, 0);
+    REQUIRE(violations == 12);
+    accessViolation = previous;
+}
+#endif
+
+TEST_CASE("Atomic field updates and deferred accumulation", "[parallel][atomic]") {
+    struct Force { float fx, fy; };
+
+    ThreadPool pool(4);
+    World world;
+    const Entity N = 1000;
+    for (Entity i = 0; i < N; ++i) {
+        auto e = create_entity(world);
+        add_component<Health>(world, e, {1000});
+        add_component<Force>(world, e, {0, 0});
+    }
+
+    // Every entity hits its next three neighbours
+    par_query<Health>(world, pool, [&](Entity e, Health*) {
+        for (Entity k = 1; k <= 3; ++k) {
+            atomic_add(world, (e + k) % N, &Health::hp, -1);
+        }
+    }, 64);
+
+    Accumulator<Force, float> forces(&Force::fx, pool);
+    par_query<Force>(world, pool, [&](Entity e, Force*) {
+        forces.add((e + 1) % N, 0.5f);
+        forces.add((e + 2) % N, 0.25f);
+    }, 64);
+    forces.apply(world);
+
+    atomic_update(world, 0, &Health::hp, [](int hp) { return std::min(hp, 500); });
+
+    int total = 0;
+    float fx = 0;
+    query<Health, Force>(world, [&](Entity, Health *h, Force *f) {
+        total += h->hp;
+        fx += f->fx;
+        REQUIRE(f->fx == Catch::Approx(0.75f));
+    });
+    REQUIRE(total == static_cast<int>(N) * 997 - 497);
+    REQUIRE(fx == Catch::Approx(0.75f * N));
+    for (auto &lane : forces.lanes) {
+        REQUIRE(lane.deltas.empty());
+    }
+}
+
+TEST_CASE("Batched gather/scatter query", "[query][batched]") {
+    World world;
+    const int N = 3000;
+    for (int i = 0; i < N; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {static_cast<float>(i), 0});
+        if (i % 5 == 0) {
+            add_component<Velocity>(world, e, {2, 3});
+        }
+    }
+
+    std::size_t batches = 0;
+    std::size_t matched = 0;
+    query_batched<Position, const Velocity>(world, [&](std::span<const Entity> es, std::span<Position> ps, std::span<const Velocity> vs) {
+        REQUIRE(es.size() <= QueryBatch);
+        REQUIRE(ps.size() == es.size());
+        for (std::size_t k = 0; k < ps.size(); ++k) {
+            ps[k].x += vs[k].vx;
+            ps[k].y += vs[k].vy;
+        }
+        ++batches;
+        matched += es.size();
+    });
+
+    REQUIRE(matched == N / 5);
+    REQUIRE(batches == (N / 5 + QueryBatch - 1) / QueryBatch);
+    REQUIRE(get_component<Position>(world, 5)->x == Catch::Approx(7.0f));
+    REQUIRE(get_component<Position>(world, 5)->y == Catch::Approx(3.0f));
+    REQUIRE(get_component<Position>(world, 6)->x == Catch::Approx(6.0f));
+
+    // Nested queries over the same type gather into their own buffers
+    std::size_t inner = 0;
+    query_batched<const Velocity>(world, [&](std::span<const Entity> es, std::span<const Velocity>) {
+        query_batched<const Velocity>(world, [&](std::span<const Entity> is, std::span<const Velocity> ivs) {
+            inner += is.size();
+            REQUIRE(ivs.front().vx == Catch::Approx(2.0f));
+        });
+        REQUIRE(es.size() <= QueryBatch);
+    });
+    REQUIRE(inner == (N / 5) * batches);
+
+    // A full batch of large components would not fit on a thread's stack
+    struct Blob { std::array<float, 16384> v; };
+    World big;
+    for (int i = 0; i < 300; ++i) {
+        add_component<Blob>(big, create_entity(big), Blob{});
+    }
+    std::size_t blobs = 0;
+    std::thread([&] {
+        query_batched<Blob>(big, [&](std::span<const Entity>, std::span<Blob> bs) {
+            bs.back().v[0] = 1.0f;
+            blobs += bs.size();
+        });
+    }).join();
+    REQUIRE(blobs == 300);
+    REQUIRE(get_component<Blob>(big, 255)->v[0] == Catch::Approx(1.0f));
+}
+
+TEST_CASE("Range-restricted queries and balanced splits", "[query][range]") {
+    World world;
+    for (int i = 0; i < 10000; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {0, 0});
+        // Matches are clustered in the first tenth of the ID space
+        if (i < 1000 || i % 100 == 0) {
+            add_component<Velocity>(world, e, {1, 1});
+        }
+    }
+
+    std::size_t inRange = 0;
+    query_range<Position, Velocity>(world, 500, 1500, [&](Entity e, Position*, Velocity*) {
+        REQUIRE((e >= 500 && e < 1500));
+        ++inRange;
+    });
+    REQUIRE(inRange == 500 + 5);
+
+    auto ranges = split_query<Position, Velocity>(world, 4);
+    REQUIRE(ranges.size() == 4);
+    REQUIRE(ranges.front().begin == 0);
+    REQUIRE(ranges.back().end == world.nextEntity);
+
+    const std::size_t total = 1000 + 90;
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        if (i > 0) {
+            REQUIRE(ranges[i].begin == ranges[i - 1].end);
+        }
+        std::size_t count = 0;
+        query_range<Position, Velocity>(world, ranges[i].begin, ranges[i].end, [&](Entity, Position*, Velocity*) { ++count; });
+        REQUIRE(count >= total / 4 - 1);
+        REQUIRE(count <= total / 4 + 1);
+        sum += count;
+    }
+    REQUIRE(sum == total);
+    REQUIRE(split_query<Position, Velocity>(world, 1)[0].end == world.nextEntity);
+}
+
+TEST_CASE("Clearing a world keeps capacity and type registrations", "[world][clear]") {
+    World world;
+    auto match = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            auto e = create_entity(world);
+            add_component<Position>(world, e, {static_cast<float>(i), 0.0f});
+            if (i % 3 == 0) {
+                add_component<State>(world, e, State::Attack);
+            }
+        }
+    };
+
+    match(1000);
+    const auto posId = world.findTypeId<Position>();
+    clear(world);
+
+    REQUIRE(world.nextEntity == 0);
+    REQUIRE(world.findTypeId<Position>() == posId);
+    int seen = 0;
+    query<Position>(world, [&](Entity, Position*) { ++seen; });
+    query_partition<State>(world, State::Attack, [&](Entity, State*) { ++seen; });
+    REQUIRE(seen == 0);
+
+    // Refilling up to the previous high-water mark does not allocate
+    const auto before = allocationCount.load();
+    match(1000);
+    REQUIRE(allocationCount.load() - before == 0);
+
+    query<Position>(world, [&](Entity, Position*) { ++seen; });
+    REQUIRE(seen == 1000);
+    int attacking = 0;
+    query_partition<State>(world, State::Attack, [&](Entity, State*) { ++attacking; });
+    REQUIRE(attacking == 334);
+}
+
+TEST_CASE("Deterministic parallel iteration and command replay", "[parallel][deterministic]") {
+    struct Spawned { Entity parent; };
+
+    auto run = [](std::size_t threads) {
+        ThreadPool pool(threads);
+        World world;
+        for (int i = 0; i < 5000; ++i) {
+            auto e = create_entity(world);
+            add_component<Position>(world, e, {0.1f * static_cast<float>(i % 97), 0.3f});
+        }
+
+        std::vector<CommandBuffer> buffers;
+        par_query_deterministic<Position>(world, pool, buffers, [](Entity e, CommandBuffer &cb, Position *p) {
+            p->y += p->x;
+            if (e % 7 == 0) {
+                auto child = cb.create();
+                cb.add<Spawned>(child, {e});
+                cb.add<Position>(child, {p->x, -1.0f});
+            }
+            if (e % 11 == 0) {
+                cb.remove<Position>(e);
+            }
+        }, 256);
+
+        const auto sum = par_reduce_deterministic<Position>(world, pool, 0.0f,
+            [](Entity, Position *p) { return p->x * 1.37f + p->y; },
+            [](float a, float b) { return a + b; }, 256);
+
+        std::vector<Entity> parents;
+        query<Spawned>(world, [&](Entity, Spawned *s) { parents.push_back(s->parent); });
+        return std::make_tuple(sum, parents, world.nextEntity);
+    };
+
+    const auto [sum1, parents1, next1] = run(1);
+    const auto [sum3, parents3, next3] = run(3);
+    const auto [sum4, parents4, next4] = run(4);
+
+    REQUIRE(std::memcmp(&sum1, &sum3, sizeof(float)) == 0);
+    REQUIRE(std::memcmp(&sum1, &sum4, sizeof(float)) == 0);
+    REQUIRE(parents1 == parents3);
+    REQUIRE(parents1 == parents4);
+    REQUIRE(next1 == next4);
+    REQUIRE(next1 == 5000 + 715);
+
+    // Children were created in chunk order
+    REQUIRE(std::is_sorted(parents1.begin(), parents1.end()));
+
+    // init is applied once, not per chunk, and bool results work
+    World world;
+    ThreadPool pool(4);
+    for (int i = 0; i < 1000; ++i) {
+        add_component<Health>(world, create_entity(world), {i});
+    }
+    const auto total = par_reduce_deterministic<Health>(world, pool, 10,
+        [](Entity, Health *h) { return h->hp; },
+        [](int a, int b) { return a + b; }, 64);
+    REQUIRE(total == 10 + 999 * 1000 / 2);
+    const auto any = par_reduce_deterministic<Health>(world, pool, false,
+        [](Entity, Health *h) { return h->hp == 500; },
+        [](bool a, bool b) { return a || b; }, 64);
+    REQUIRE(any);
+}
+
+TEST_CASE("Lock-free channels feed command buffers", "[channel]") {
+    SECTION("SPSC keeps order across wrap-around") {
+        SpscChannel<int> ch(64);
+        constexpr int total = 100000;
+        std::thread producer([&] {
+            std::array<int, 16> batch;
+            for (int next = 0; next < total;) {
+                const auto n = std::min<int>(batch.size(), total - next);
+                for (int i = 0; i < n; ++i) {
+                    batch[i] = next + i;
+                }
+                auto pushed = ch.push(std::span<const int>(batch.data(), n));
+                next += static_cast<int>(pushed);
+                if (pushed == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        std::array<int, 32> out;
+        int expected = 0;
+        bool ordered = true;
+        while (expected < total) {
+            const auto n = ch.pop(out);
+            for (std::size_t i = 0; i < n; ++i) {
+                ordered &= out[i] == expected++;
+            }
+            if (n == 0) {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        REQUIRE(ordered);
+    }
+
+    SECTION("MPSC keeps per-producer order") {
+        struct Msg { int producer, seq; };
+        MpscChannel<Msg> ch(128);
+        constexpr int producers = 3;
+        constexpr int perProducer = 20000;
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&ch, p] {
+                std::array<Msg, 8> batch;
+                for (int next = 0; next < perProducer;) {
+                    const auto n = std::min<int>(batch.size(), perProducer - next);
+                    for (int i = 0; i < n; ++i) {
+                        batch[i] = {p, next + i};
+                    }
+                    auto pushed = ch.push(std::span<const Msg>(batch.data(), n));
+                    next += static_cast<int>(pushed);
+                    if (pushed == 0) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        std::array<int, producers> expected{};
+        std::array<Msg, 16> out;
+        bool ordered = true;
+        for (int received = 0; received < producers * perProducer;) {
+            const auto n = ch.pop(out);
+            for (std::size_t i = 0; i < n; ++i) {
+                ordered &= out[i].seq == expected[out[i].producer]++;
+            }
+            received += static_cast<int>(n);
+            if (n == 0) {
+                std::this_thread::yield();
+            }
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        REQUIRE(ordered);
+        REQUIRE(expected == std::array<int, producers>{perProducer, perProducer, perProducer});
+    }
+
+    SECTION("Messages are applied to a world in one batch") {
+        struct Spawn { Position pos; };
+        World world;
+        MpscChannel<Spawn> ch(32);
+        for (int i = 0; i < 20; ++i) {
+            REQUIRE(ch.push(Spawn{{static_cast<float>(i), 0.0f}}));
+        }
+
+        CommandBuffer cb;
+        std::array<Spawn, 8> scratch;
+        const auto handled = receive(world, ch, std::span<Spawn>(scratch), cb, [](CommandBuffer &c, const Spawn &m) {
+            c.add<Position>(c.create(), m.pos);
+        });
+
+        REQUIRE(handled == 20);
+        REQUIRE(cb.empty());
+        float sum = 0.0f;
+        query<Position>(world, [&](Entity e, Position *p) {
+            REQUIRE(p->x == static_cast<float>(e));
+            sum += p->x;
+        });
+        REQUIRE(sum == 190.0f);
+    }
+}
+
+TEST_CASE("Hot/cold split components and field access statistics", "[split][fields]") {
+    struct Unit { float x, y, speed; int faction; char title[32]; };
+    struct UnitHot { float x, y, speed; };
+    struct UnitCold { int faction; char title[32]; };
+    using SplitUnit = Split<UnitHot, UnitCold>;
+
+    SECTION("Field counts suggest which fields to move") {
+        reset_field_stats();
+        Unit units[64] = {};
+        for (int tick = 0; tick < 100; ++tick) {
+            for (auto &u : units) {
+                EC_FIELD(&u, x) += EC_FIELD(&u, speed);
+                EC_FIELD(&u, y) += EC_FIELD(&u, speed);
+            }
+        }
+        for (auto &u : units) {
+            EC_FIELD(&u, faction) = 1;
+            std::strcpy(EC_FIELD(&u, title), "grunt");
+        }
+
+        const auto report = field_report();
+        const auto it = std::find_if(report.begin(), report.end(), [](const FieldAdvice &a) {
+            return a.type == typeid(Unit).name();
+        });
+        REQUIRE(it != report.end());
+        auto hot = it->hot;
+        std::sort(hot.begin(), hot.end());
+        REQUIRE(hot == std::vector<std::string>{"speed", "x", "y"});
+        REQUIRE(it->cold == std::vector<std::string>{"faction", "title"});
+        REQUIRE(it->hotBytes == 3 * sizeof(float));
+        REQUIRE(it->coldBytes == sizeof(int) + 32);
+        REQUIRE(units[0].faction == 1);
+    }
+
+    SECTION("Split parts live in separate pools behind one logical component") {
+        World world;
+        auto a = create_entity(world);
+        auto b = create_entity(world);
+        REQUIRE(add_component<SplitUnit>(world, a, {{1, 2, 3}, {7, "knight"}}) == Status::OK);
+        REQUIRE(add_component<SplitUnit>(world, b, {{4, 5, 6}, {8, "archer"}}) == Status::OK);
+
+        auto u = get_component<SplitUnit>(world, a);
+        REQUIRE(u);
+        REQUIRE(u.hot->speed == 3);
+        REQUIRE(u.cold->faction == 7);
+        REQUIRE(std::string(u.cold->title) == "knight");
+
+        const auto cu = get_component<const SplitUnit>(world, b);
+        static_assert(std::is_same_v<decltype(cu.hot), const UnitHot*>);
+        REQUIRE(cu.cold->faction == 8);
+
+        // The hot loop touches only the hot pool
+        query<UnitHot>(world, [](Entity, UnitHot *h) { h->x += h->speed; });
+        REQUIRE(get_component<SplitUnit>(world, a).hot->x == 4);
+        REQUIRE(world.findPool<UnitHot>() != nullptr);
+        REQUIRE(world.findPool<UnitCold>() != nullptr);
+        REQUIRE(world.findPool<SplitUnit>() == nullptr);
+
+        REQUIRE(remove_component<SplitUnit>(world, a) == Status::OK);
+        REQUIRE(!get_component<SplitUnit>(world, a));
+        REQUIRE(get_component<UnitCold>(world, a) == nullptr);
+        REQUIRE(get_component<SplitUnit>(world, b));
+    }
+}
+
+TEST_CASE("Adaptive pools switch between dense and sparse layouts", "[pool][adaptive]") {
+    World world;
+    constexpr int n = 4000;
+    for (int i = 0; i < n; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {static_cast<float>(i), 0.0f});
+        add_component<Buffs>(world, e, {1.0f, 0.0f, 0.0f, 0.0f, i});
+    }
+
+    auto *pool = world.findPool<Buffs>();
+    REQUIRE(!pool->sparse);
+
+    // Below 5% occupancy the full-length array is released. Removing inside
+    // a query keeps the layout until the query returns.
+    bool switched = false;
+    query<Buffs>(world, [&](Entity e, Buffs *) {
+        if (e % 50 != 0) {
+            remove_component<Buffs>(world, e);
+        }
+        switched = switched || pool->sparse;
+    });
+    REQUIRE(!switched);
+    REQUIRE(pool->sparse);
+    REQUIRE(pool->count == n / 50);
+    REQUIRE(pool->data.capacity() == 0);
+
+    REQUIRE(get_component<Buffs>(world, 100)->stacks == 100);
+    REQUIRE(get_component<Buffs>(world, 101) == nullptr);
+    REQUIRE(static_cast<Buffs*>(get_component(world, 150, world.findTypeId<Buffs>()))->stacks == 150);
+
+    std::vector<Entity> seen;
+    query<Position, Buffs>(world, [&](Entity e, Position *p, Buffs *b) {
+        REQUIRE(p->x == static_cast<float>(b->stacks));
+        seen.push_back(e);
+    });
+    REQUIRE(seen.size() == n / 50);
+
+    // Snapshots read sparse pools per entity instead of densifying them
+    std::stringstream stream;
+    SnapshotCodec codec;
+    REQUIRE(save_snapshot(world, stream, codec) == Status::OK);
+    REQUIRE(pool->sparse);
+
+    // So does the Arrow export, into a packed copy it owns
+    ArrowArray array;
+    ArrowSchema schema;
+    REQUIRE(export_column(world, world.findTypeId<Buffs>(), &array, &schema) == Status::OK);
+    REQUIRE(pool->sparse);
+    REQUIRE(static_cast<const Buffs*>(array.buffers[1])[150].stacks == 150);
+    array.release(&array);
+    schema.release(&schema);
+
+    // Hysteresis: 10% is between the thresholds, so the layout stays sparse
+    for (int i = 1; i < n; i += 20) {
+        add_component<Buffs>(world, static_cast<Entity>(i), {0.0f, 0.0f, 0.0f, 0.0f, i});
+    }
+    REQUIRE(pool->sparse);
+
+    // Cross-world copies handle a sparse source
+    World other;
+    const auto remap = merge(other, world);
+    REQUIRE(get_component<Buffs>(other, remap[150])->stacks == 150);
+    REQUIRE(get_component<Buffs>(other, remap[151]) == nullptr);
+
+    // Above 20% it goes dense again, here after the outermost query returns
+    query<Position>(world, [&](Entity e, Position *) {
+        if (e % 4 == 2) {
+            add_component<Buffs>(world, e, {0.0f, 0.0f, 0.0f, 0.0f, static_cast<int>(e)});
+            query<Buffs>(world, [](Entity, Buffs *) {});
+        }
+        switched = switched || !pool->sparse;
+    });
+    REQUIRE(!switched);
+    REQUIRE(!pool->sparse);
+    int matched = 0;
+    query<Buffs>(world, [&](Entity e, Buffs *b) {
+        REQUIRE(b->stacks == static_cast<int>(e));
+        ++matched;
+    });
+    REQUIRE(matched == static_cast<int>(pool->count));
+}
+
+TEST_CASE("Capacity planning and memory budget", "[world][reserve]") {
+    SECTION("Reserved worlds fill without allocating") {
+        World world;
+        REQUIRE(reserve_entities(world, 10000) == Status::OK);
+        REQUIRE(reserve<Position>(world, 10000) == Status::OK);
+        REQUIRE(reserve<State>(world, 10000) == Status::OK);
+
+        const auto before = allocationCount.load();
+        for (int i = 0; i < 10000; ++i) {
+            auto e = create_entity(world);
+            add_component<Position>(world, e, {1.0f, 2.0f});
+            if (i % 4 == 0) {
+                add_component<State>(world, e, State::Idle);
+            }
+        }
+        // Everything, partition buckets included, was planned
+        const auto allocations = allocationCount.load() - before;
+        REQUIRE(allocations == 0);
+        REQUIRE(world.alive.capacity() == 10000);
+        REQUIRE(world.findPool<Position>()->data.capacity() == 10000);
+    }
+
+    SECTION("Growth past the budget fails fast") {
+        World world;
+        world.memoryBudget = 1000;
+        REQUIRE(reserve<Health>(world, 0) == Status::OK);
+        const auto perSlot = world.slotBytes();
+        REQUIRE(perSlot == 1 + sizeof(Health) + 1);
+
+        std::size_t created = 0;
+        while (create_entity(world) != NullEntity) {
+            ++created;
+        }
+        REQUIRE(created == 1000 / perSlot);
+        REQUIRE(world.alive.capacity() * perSlot <= 1000);
+        REQUIRE(world.nextEntity == created);
+
+        REQUIRE(add_component<Health>(world, 0, {5}) == Status::OK);
+        REQUIRE(add_component<Position>(world, 0, {0.0f, 0.0f}) == Status::ERROR);
+        REQUIRE(world.findPool<Position>() == nullptr);
+        REQUIRE(reserve_entities(world, 1000) == Status::ERROR);
+
+        World src;
+        add_component<Health>(src, create_entity(src), {1});
+        const auto remap = merge(world, src);
+        REQUIRE(remap[0] == NullEntity);
+        REQUIRE(world.nextEntity == created);
+
+        // Every way of creating a pool is held to the budget
+        ComponentInfo info;
+        info.size = 64;
+        REQUIRE(register_component(world, "Blob", info) == NullType);
+        REQUIRE(register_component<Position>(world) == NullType);
+
+        CommandBuffer cb;
+        cb.add<Position>(0, {1.0f, 1.0f});
+        apply(world, cb);
+        REQUIRE(world.findPool<Position>() == nullptr);
+
+        World other;
+        const auto before = world.nextEntity;
+        add_component<Position>(other, create_entity(other), {0.0f, 0.0f});
+        REQUIRE(merge(world, other)[0] == NullEntity);
+        const Entity ids[] = {0};
+        REQUIRE(copy_entities(world, other, ids)[0] == NullEntity);
+        REQUIRE(world.findPool<Position>() == nullptr);
+        REQUIRE(world.nextEntity == before);
+    }
+}
+
+TEST_CASE("Memory-mapped pools can be evicted and paged back in", "[pool][mapped]") {
+    World world;
+    constexpr int n = 5000;
+    for (int i = 0; i < n; ++i) {
+        auto e = create_entity(world);
+        add_component<Position>(world, e, {static_cast<float>(i), 0.0f});
+        if (i % 2 == 0) {
+            History h{};
+            h.samples[3] = static_cast<float>(i);
+            h.count = i;
+            add_component<History>(world, e, h);
+        }
+    }
+
+    evict<History>(world);
+    evict<Position>(world);
+
+    REQUIRE(get_component<History>(world, 42)->count == 42);
+    REQUIRE(get_component<History>(world, 43) == nullptr);
+
+    int matched = 0;
+    query<Position, History>(world, [&](Entity, Position *p, History *h) {
+        REQUIRE(h->samples[3] == p->x);
+        h->count += 1;
+        ++matched;
+    });
+    REQUIRE(matched == n / 2);
+
+    evict<History>(world);
+    REQUIRE(get_component<History>(world, 100)->count == 101);
+
+    // Whole-block copies between mapped pools
+    World other;
+    const auto remap = merge(other, world);
+    REQUIRE(get_component<History>(other, remap[200])->count == 201);
+    REQUIRE(remove_component<History>(other, remap[200]) == Status::OK);
+    REQUIRE(get_component<History>(other, remap[200]) == nullptr);
+}
+
+TEST_CASE("Compressed delta snapshots", "[snapshot]") {
+    SECTION("LZ round trip") {
+        std::mt19937 rng(7);
+        std::vector<std::uint8_t> input(20000);
+        for (std::size_t i = 0; i < input.size(); ++i) {
+            input[i] = i % 1000 < 500 ? 0 : static_cast<std::uint8_t>(rng() % 4);
+        }
+        std::vector<std::uint8_t> packed;
+        lz_compress(input, packed);
+        REQUIRE(packed.size() < input.size() / 2);
+
+        std::vector<std::uint8_t> output(input.size());
+        REQUIRE(lz_decompress(packed, output));
+        REQUIRE(output == input);
+        packed.pop_back();
+        REQUIRE(!lz_decompress(packed, output));
+    }
+
+    SECTION("Keyframe and deltas restore the world") {
+        World world;
+        constexpr int n = 20000;
+        for (int i = 0; i < n; ++i) {
+            auto e = create_entity(world);
+            add_component<Position>(world, e, {static_cast<float>(i % 100), 1.0f});
+            if (i % 3 == 0) {
+                add_component<State>(world, e, static_cast<State>(i % 4));
+            }
+            if (i % 10 == 0) {
+                add_component<Health>(world, e, {100});
+            }
+        }
+        destroy_entity(world, 5);
+
+        SnapshotCodec writer;
+        std::stringstream key;
+        REQUIRE(save_snapshot(world, key, writer) == Status::OK);
+        const auto rawBytes = static_cast<std::size_t>(n) * (1 + 1 + sizeof(Position) + 1 + sizeof(State) + 1 + sizeof(Health));
+        REQUIRE(key.str().size() < rawBytes / 4);
+
+        // A small change compresses to far less than the keyframe
+        for (int i = 0; i < n; i += 500) {
+            get_component<Position>(world, static_cast<Entity>(i))->y += 1.0f;
+        }
+        add_component<State>(world, 1, State::Flee);
+        remove_component<Health>(world, 10);
+        std::stringstream delta;
+        REQUIRE(save_snapshot(world, delta, writer) == Status::OK);
+        REQUIRE(delta.str().size() < key.str().size() / 4);
+
+        World restored;
+        register_component<Position>(restored);
+        register_component<State>(restored);
+        register_component<Health>(restored);
+        SnapshotCodec reader;
+
+        // Deltas only apply on top of the snapshot they were taken against
+        std::stringstream early(delta.str());
+        REQUIRE(load_snapshot(restored, early, reader) == Status::ERROR);
+
+        REQUIRE(load_snapshot(restored, key, reader) == Status::OK);
+        REQUIRE(load_snapshot(restored, delta, reader) == Status::OK);
+
+        REQUIRE(restored.nextEntity == world.nextEntity);
+        REQUIRE(!restored.alive[5]);
+        bool same = true;
+        for (Entity e = 0; e < world.nextEntity; ++e) {
+            const auto *a = get_component<Position>(world, e);
+            const auto *b = get_component<Position>(restored, e);
+            same &= a && b && a->x == b->x && a->y == b->y;
+            same &= (get_component<Health>(world, e) == nullptr) == (get_component<Health>(restored, e) == nullptr);
+        }
+        REQUIRE(same);
+        REQUIRE(*get_component<State>(restored, 1) == State::Flee);
+
+        int attacking = 0;
+        query_partition<State>(restored, State::Attack, [&](Entity, State*) { ++attacking; });
+        int expected = 0;
+        query_partition<State>(world, State::Attack, [&](Entity, State*) { ++expected; });
+        REQUIRE(attacking == expected);
+    }
+}
+
+TEST_CASE("Structural changes inside query callbacks", "[query][structure]") {
+    World world;
+    for (int i = 0; i < 100; ++i) {
+        add_component<Position>(world, create_entity(world), {static_cast<float>(i), 0.0f});
+    }
+
+    // Spawning grows alive flags and pools under the loop; entities created
+    // before the loop reaches their IDs are visited too
+    int visited = 0;
+    query<Position>(world, [&](Entity e, Position *p) {
+        ++visited;
+        p->y = 1.0f;
+        if (e < 100 && e % 2 == 0) {
+            // p dangles once the world grows
+            const auto x = p->x;
+            auto child = create_entity(world);
+            add_component<Position>(world, child, {x, 0.0f});
+            add_component<Velocity>(world, child, {1.0f, 1.0f});
+        }
+    });
+    REQUIRE(visited == 150);
+    REQUIRE(world.nextEntity == 150);
+
+    int marked = 0;
+    query<Position>(world, [&](Entity, Position *p) { marked += p->y == 1.0f; });
+    REQUIRE(marked == 150);
+
+    // Untyped queries re-resolve as well
+    const std::size_t ids[] = {world.findTypeId<Position>()};
+    visited = 0;
+    query_dynamic(world, ids, [&](Entity e, void* const*) {
+        ++visited;
+        if (e == 0) {
+            for (int i = 0; i < 1000; ++i) {
+                add_component<Position>(world, create_entity(world), {0.0f, 0.0f});
+            }
+        }
+    });
+    REQUIRE(visited == 1150);
+}